@@ -33,7 +33,7 @@ _dma_clear:
     ldr r4, =0xC008 // Enable, acknowledge error, flush
     str r4, [r3, #0x184] // IPCFIFOCNT
 
-    // Copy up to 160 bytes to the stack area.
+    // Copy up to 96 bytes to the stack area.
     adr r0, _stage2
     ldr r1, =0x380FE00
     mov lr, r1
@@ -43,10 +43,13 @@ _dma_clear:
     stmiage r1!, {r3-r10}
     ldmiage r0!, {r3-r10}
     stmiage r1!, {r3-r10}
-    ldmiage r0!, {r3-r10}
-    stmiage r1!, {r3-r10}
-    ldmiage r0!, {r3-r10}
-    stmiage r1!, {r3-r10}
+
+    // Locate the resident loader (stage3) in this image.
+    adr r4, _start
+    ldr r5, =__stage3_offset
+    add r4, r4, r5
+    ldr r5, =__stage3_start
+    ldr r6, =__stage3_size
 
     ldr r8, =0x4000180
     add r9, r8, #8
@@ -59,7 +62,10 @@ _dma_clear:
 
     .pool
     
-    // stage2 must be at most 160 bytes.
+    // stage2 must be at most 96 bytes.
+    // r4 = stage3 source
+    // r5 = stage3 destination
+    // r6 = stage3 size
     // r8 = IPCSYNC
     // r9 = IPCFIFOSEND
     // r10 = IPCFIFORECV
@@ -71,41 +77,20 @@ _stage2_init:
 _stage2_sync_loop:
     bl _stage2_wait_recv_r7
     add r7, r7, #0x1
-    ands r7, r7, #0xF
+    // IPC_SYNC_STEPS in source/arm9/ipc.h
+    cmp r7, #(3 + 1)
     bne _stage2_sync_loop
-_stage2_next_cmd:
-    bl _stage2_bump_counter
-    mov r7, #0
-    bl _stage2_wait_recv_r7
-_stage2_wait_cmd:
-    ldr r0, [r8]
-    and r0, r0, #0xF
-    // command 0xF = synchronize
-    cmp r0, #0xF
-    beq _stage2_next_cmd
-    cmp r0, #0x2
-    beq _stage2_cmd2
-    cmp r0, #0x1
-    bne _stage2_wait_cmd
-
-    // command 0x1 = copy N1 bytes from N2 to N3
-_stage2_cmd1:
-    ldr r0, [r10]
-    ldr r2, [r10]
-    ldr r1, [r10]
-    // r1 = destination address
-    // r2 = source address
-_stage2_copy:
-    subs r0, r0, #4
-    ldrge r3, [r2], #4
-    strge r3, [r1], #4
-    bgt _stage2_copy
-    b _stage2_next_cmd
 
-    // command 0x2 = jump to entrypoint, which is already set in the header
-_stage2_cmd2:
-    bl _stage2_bump_counter
-    swi 0
+    // The ARM9 maps VRAM banks C and D to the ARM7 before synchronizing,
+    // and does not load anything until stage3 acknowledges the last sync
+    // step, so its source in main RAM is still intact at this point.
+    mov lr, r5
+_stage2_copy_stage3:
+    ldmia r4!, {r0-r3}
+    stmia r5!, {r0-r3}
+    subs r6, r6, #16
+    bgt _stage2_copy_stage3
+    bx lr
 
     // wait to receive the value in r7 from ARM9 via IPC, then send N+1
 _stage2_wait_recv_r7:
@@ -118,5 +103,12 @@ _stage2_wait_recv_r7:
 _stage2_bump_counter:
     add r12, r12, #0x100
     and r12, r12, #0xF00
-    str r12, [r8]
+    // Also raise the ARM9's IPC sync IRQ, which it sleeps on.
+    orr r0, r12, #0x2000
+    str r0, [r8]
     bx lr
+_stage2_end:
+
+.if (_stage2_end - _stage2) > 96
+.error "stage2 is larger than 96 bytes"
+.endif
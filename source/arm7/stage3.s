@@ -0,0 +1,258 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+    .arm
+    .syntax unified
+
+    // stage3 is the resident loader, which runs from ARM7 VRAM (banks C
+    // and D): unlike ARM7 RAM and main RAM, no binary can be loaded there.
+    // It is entered from stage2 with the last sync step still to be
+    // acknowledged.
+    // r8 = IPCSYNC
+    // r9 = IPCFIFOSEND
+    // r10 = IPCFIFORECV
+    // r11 = 0
+    // r12 = counter for IPCSYNC
+    .global _stage3
+    .section .stage3, "ax"
+_stage3:
+    // Run timer 0 at the ARM9's timing rate (33 MHz / 64), to time copies.
+    mov r0, #0x810000
+    str r0, [r8, #-0x80]
+    // Enable the IPC sync IRQ, to wake up from halt when the ARM9 writes
+    // to IPCSYNC. IME stays off: the IRQ is never taken.
+    mov r0, #0x10000
+    str r0, [r8, #0x90] // IE
+    // The last sync step is the ARM9's IPC_ARM7_NONE: answer it, and only
+    // it, with the next number.
+    b _stage3_wait_none
+_stage3_next_cmd:
+    bl _stage3_bump_counter
+_stage3_wait_none:
+    mov r7, #0
+    bl _stage3_wait_recv_r7
+_stage3_wait_cmd:
+    mov r0, #0x10000
+    str r0, [r8, #0x94] // IF
+    ldr r0, [r8]
+    and r0, r0, #0xF
+    // command 0xF = synchronize
+    cmp r0, #0xF
+    beq _stage3_next_cmd
+    cmp r0, #0x3
+    beq _stage3_cmd3
+    cmp r0, #0x2
+    beq _stage3_cmd2
+    cmp r0, #0x1
+    beq _stage3_cmd1
+    // Sleep until the ARM9 writes to IPCSYNC.
+    mov r0, #0x80
+    strb r0, [r8, #0x181] // HALTCNT
+    b _stage3_wait_cmd
+
+    // command 0x1 = run the jobs in the ring at N1, up to job number N2
+    // The command is acknowledged as soon as the arguments are received,
+    // so that the ARM9 can continue loading while the jobs run; the
+    // following command 0x0 is only acknowledged once they have finished.
+    // See ipc_job_ring_t in source/arm9/ipc.h for the ring layout.
+_stage3_cmd1:
+    ldr r1, [r10]
+    ldr r2, [r10]
+    bl _stage3_bump_counter
+    // r1 = ring
+    // r2 = end job number
+    // r3 = current job number
+    ldr r3, [r1, #0x100]
+_stage3_next_job:
+    cmp r3, r2
+    beq _stage3_wait_none
+    and r0, r3, #0xF
+    add r0, r1, r0, lsl #4
+    ldmia r0, {r0, r4, r5, r6}
+    // r4 = source address, or fill value
+    // r5 = destination address
+    // r6 = size
+    cmp r0, #0x3
+    beq _stage3_pack
+    cmp r0, #0x2
+    moveq r4, #0
+    cmp r0, #0x0
+    bne _stage3_fill
+_stage3_copy:
+    // Copy whole words with DMA channel 3, and anything it cannot handle
+    // (unaligned addresses, the last 1-3 bytes) with the CPU.
+    // lr = timer 0 value at the start of the copy
+    ldrh lr, [r8, #-0x80]
+    orr r0, r4, r5
+    tst r0, #3
+    bne _stage3_copy_bytes
+    sub r0, r8, #0xAC
+_stage3_copy_dma:
+    cmp r6, #4
+    blo _stage3_copy_bytes
+    // The word count field is 16 bits wide: copy at most 64 KB at a time.
+    cmp r6, #0x10000
+    movhs r7, #0x4000
+    movlo r7, r6, lsr #2
+    orr r7, r7, #0x84000000
+    stmia r0, {r4, r5, r7}
+    bic r7, r7, #0xFF000000
+    add r4, r4, r7, lsl #2
+    add r5, r5, r7, lsl #2
+    sub r6, r6, r7, lsl #2
+_stage3_copy_dma_wait:
+    ldr r7, [r0, #8]
+    tst r7, #0x80000000
+    bne _stage3_copy_dma_wait
+    b _stage3_copy_dma
+_stage3_copy_bytes:
+    subs r6, r6, #1
+    ldrbge r0, [r4], #1
+    strbge r0, [r5], #1
+    bgt _stage3_copy_bytes
+    // Add the time taken to the ring's copy_ticks.
+    ldrh r0, [r8, #-0x80]
+    sub r0, r0, lr
+    mov r0, r0, lsl #16
+    ldr r7, [r1, #0x104]
+    add r7, r7, r0, lsr #16
+    str r7, [r1, #0x104]
+    b _stage3_job_done
+_stage3_fill:
+    subs r6, r6, #4
+    strge r4, [r5], #4
+    bgt _stage3_fill
+    b _stage3_job_done
+_stage3_pack:
+    // Pack words as literal records and zero runs; see IPC_JOB_PACK in
+    // source/arm9/ipc.h for the format.
+    push {r1-r3}
+    str r6, [r5], #4
+    add r6, r4, r6
+    // r7 = literal record
+    // r1 = its word count
+_stage3_pack_record:
+    mov r7, r5
+    add r5, r5, #4
+    mov r1, #0
+_stage3_pack_word:
+    cmp r4, r6
+    bhs _stage3_pack_done
+    ldr r0, [r4]
+    cmp r0, #0
+    beq _stage3_pack_zeros
+_stage3_pack_literal:
+    str r0, [r5], #4
+    add r4, r4, #4
+    add r1, r1, #1
+    b _stage3_pack_word
+_stage3_pack_zeros:
+    // Runs of fewer than three zero words are cheaper as literals.
+    mov r2, r4
+_stage3_pack_zeros_count:
+    add r2, r2, #4
+    cmp r2, r6
+    bhs _stage3_pack_zeros_end
+    ldr r3, [r2]
+    cmp r3, #0
+    beq _stage3_pack_zeros_count
+_stage3_pack_zeros_end:
+    sub r3, r2, r4
+    cmp r3, #12
+    blo _stage3_pack_literal
+    str r1, [r7]
+    mov r3, r3, lsr #2
+    orr r3, r3, #0x80000000
+    str r3, [r5], #4
+    mov r4, r2
+    b _stage3_pack_record
+_stage3_pack_done:
+    str r1, [r7]
+    pop {r1-r3}
+_stage3_job_done:
+    // Post the completion.
+    add r3, r3, #1
+    str r3, [r1, #0x100]
+    b _stage3_next_job
+
+    // command 0x2 = jump to entrypoint, which is already set in the header
+_stage3_cmd2:
+    str r11, [r8, #-0x80]
+    bl _stage3_bump_counter
+    // Leave no IRQ state behind for the loaded program.
+    str r11, [r8, #0x90] // IE
+    mvn r0, r11
+    str r0, [r8, #0x94] // IF
+    str r12, [r8]
+    swi 0
+
+    // command 0x3 = find the first word-aligned occurrence of the words
+    // N3, N4, N5 in the N2 bytes starting at N1, then send its address
+    // (or 0) back. Acknowledged like command 0x1.
+_stage3_cmd3:
+    ldr r1, [r10]
+    ldr r2, [r10]
+    ldr r4, [r10]
+    ldr r5, [r10]
+    ldr r6, [r10]
+    bl _stage3_bump_counter
+    // r1 = current address
+    // r2 = bytes left
+_stage3_scan:
+    // Compare four words per ldm against the first word; on a possible
+    // match, and for the last few words, check one word at a time.
+    cmp r2, #16
+    blo _stage3_scan_tail
+    ldmia r1!, {r0, r3, r7, lr}
+    cmp r0, r4
+    cmpne r3, r4
+    cmpne r7, r4
+    cmpne lr, r4
+    subne r2, r2, #16
+    bne _stage3_scan
+    sub r1, r1, #16
+    mov r3, #16
+    b _stage3_scan_words
+_stage3_scan_tail:
+    movs r3, r2
+    moveq r0, #0
+    beq _stage3_scan_done
+_stage3_scan_words:
+    ldr r0, [r1], #4
+    sub r2, r2, #4
+    cmp r0, r4
+    ldreq r0, [r1]
+    cmpeq r0, r5
+    ldreq r0, [r1, #4]
+    cmpeq r0, r6
+    subeq r0, r1, #4
+    beq _stage3_scan_done
+    subs r3, r3, #4
+    bne _stage3_scan_words
+    b _stage3_scan
+_stage3_scan_done:
+    str r0, [r9]
+    b _stage3_wait_none
+
+    // wait to receive the value in r7 from ARM9 via IPC, then send N+1
+_stage3_wait_recv_r7:
+    // Acknowledge the IRQ before checking, so that a write arriving in
+    // between still ends the halt.
+    mov r0, #0x10000
+    str r0, [r8, #0x94] // IF
+    ldr r0, [r8]
+    and r0, r0, #0xF
+    cmp r0, r7
+    beq _stage3_bump_counter
+    mov r0, #0x80
+    strb r0, [r8, #0x181] // HALTCNT
+    b _stage3_wait_recv_r7
+
+    // send N+1 to ARM9 via IPC, raising its IPC sync IRQ
+_stage3_bump_counter:
+    add r12, r12, #0x100
+    and r12, r12, #0xF00
+    orr r0, r12, #0x6000
+    str r0, [r8]
+    bx lr
@@ -7,14 +7,23 @@
 
 #include <stdint.h>
 
+// Identifies miniboot's own bootstub, as opposed to any other dkA bootstub.
+#define BOOTSTUB_MAGIC 0x424D4E4D // "MNMB" in ASCII
+
 typedef struct {
     uint32_t arm9_entry;
     uint32_t arm7_entry;
     void *arm9_target_entry;
     void *arm7_target_entry;
+    uint32_t magic;
+    void *warmboot;
+    void *arm9_packed;
+    void *arm9_start;
+    void *arm9_restart;
 } bootstub_header_t;
 
 extern bootstub_header_t bootstub;
+extern char bootstub_arm9_unpack;
 extern char bootstub_end;
 #define bootstub_size ((uint32_t) (((uint8_t*) &bootstub_end) - ((uint8_t*) &bootstub)))
 
@@ -2,6 +2,8 @@
 //
 // Copyright (c) 2024 Adrian "asie" Siekierka
 
+#include "cp15_asm.h"
+
     .arm
     .syntax unified
 
@@ -19,6 +21,16 @@ bootstub_arm9_target:
     .word 0                 // ARM9 target entrypoint, user-provided
 bootstub_arm7_target:
     .word 0                 // ARM7 target entrypoint, user-provided
+bootstub_magic:
+    .word 0x424D4E4D        // BOOTSTUB_MAGIC, see bootstub.h
+bootstub_warmboot:
+    .word 0                 // Warm boot record, see warmboot.h
+bootstub_arm9_packed:
+    .word 0                 // miniboot's ARM9 binary, packed by IPC_JOB_PACK
+bootstub_arm9_start:
+    .word 0                 // Where the ARM9 binary is unpacked to
+bootstub_arm9_restart:
+    .word 0                 // miniboot's ARM9 entrypoint, once unpacked
 
 // Bootstub code follows here.
 bootstub_arm9_entry:
@@ -83,6 +95,59 @@ bootstub_arm7_entry:
     // BIOS soft reset time!
     swi 0
 
+// The ARM9 is reset to here: unpack miniboot's ARM9 binary to where it was
+// first loaded, and start it. See ipc.h for the format. The exiting
+// program may have left the caches on, so write back the data cache, and
+// turn the caches and the protection unit off first.
+    .global bootstub_arm9_unpack
+bootstub_arm9_unpack:
+    mov r1, #0
+.Lflush_line:
+    mov r0, r1
+.Lflush_segment:
+    mcr CP15_REG7_CLEAN_FLUSH_DCACHE_ENTRY_BY_INDEX(r0)
+    adds r0, r0, #0x40000000
+    bcc .Lflush_segment
+    add r1, r1, #CACHE_LINE_SIZE
+    cmp r1, #(DCACHE_SIZE / ENTRIES_PER_SEGMENT)
+    bne .Lflush_line
+    mov r0, #0
+    mcr CP15_REG7_DRAIN_WRITE_BUFFER
+
+    mrc CP15_REG1_CONTROL_REGISTER(r0)
+    bic r0, r0, #CP15_CONTROL_ICACHE_ENABLE
+    bic r0, r0, #(CP15_CONTROL_DCACHE_ENABLE | CP15_CONTROL_PROTECTION_UNIT_ENABLE)
+    mcr CP15_REG1_CONTROL_REGISTER(r0)
+    mov r0, #0
+    mcr CP15_REG7_FLUSH_ICACHE
+    mcr CP15_REG7_FLUSH_DCACHE
+
+    ldr r0, bootstub_arm9_packed
+    ldr r1, bootstub_arm9_start
+    ldr r2, [r0], #4
+    add r2, r1, r2        // End of the unpacked binary.
+    mov r4, #0
+.Lunpack_record:
+    cmp r1, r2
+    bhs .Lunpack_done
+    ldr r3, [r0], #4
+    movs r3, r3, lsl #1   // Carry = zero run, r3 = word count * 2
+    bcs .Lunpack_zeros
+.Lunpack_literals:
+    subs r3, r3, #2
+    ldrge r12, [r0], #4
+    strge r12, [r1], #4
+    bgt .Lunpack_literals
+    b .Lunpack_record
+.Lunpack_zeros:
+    subs r3, r3, #2
+    strge r4, [r1], #4
+    bgt .Lunpack_zeros
+    b .Lunpack_record
+.Lunpack_done:
+    ldr r0, bootstub_arm9_restart
+    bx r0
+
     .pool
 
     .global bootstub_end
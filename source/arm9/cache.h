@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+
+/* While loading, main RAM (0x2000000 - 0x23FFFFF) is cached write-back;
+   its mirrors, I/O and VRAM are not. Anything in main RAM read by the ARM7
+   or written by DMA has to be flushed first. See crt0.s. */
+
+/**
+ * @brief Write back and invalidate the data cache lines covering a range.
+ */
+void dc_flush_range(const void *base, uint32_t size);
+
+/**
+ * @brief Write back and invalidate the whole data cache.
+ */
+void dc_flush_all(void);
+
+/**
+ * @brief Write back the data cache, then disable it and the protection unit.
+ */
+void cache_disable(void);
+
+#endif /* __CACHE_H__ */
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#include "cp15_asm.h"
+
+    .arm
+    .syntax unified
+
+// void dc_flush_range(const void *base, uint32_t size);
+//
+// Write back and invalidate the data cache lines covering a memory range.
+    .global dc_flush_range
+    .section .text.dc_flush_range, "ax", %progbits
+    .type dc_flush_range, %function
+dc_flush_range:
+    add     r1, r1, r0
+    bic     r0, r0, #(CACHE_LINE_SIZE - 1)
+.Lflush_range:
+    mcr     CP15_REG7_CLEAN_FLUSH_DCACHE_ENTRY(r0)
+    add     r0, r0, #CACHE_LINE_SIZE
+    cmp     r0, r1
+    blo     .Lflush_range
+    mov     r0, #0
+    mcr     CP15_REG7_DRAIN_WRITE_BUFFER
+    bx      lr
+
+// void dc_flush_all(void);
+//
+// Write back and invalidate the whole data cache, by index: the segment is
+// in bits 30-31, the line in bits 5-9.
+    .global dc_flush_all
+    .section .text.dc_flush_all, "ax", %progbits
+    .type dc_flush_all, %function
+dc_flush_all:
+    mov     r1, #0
+.Lflush_line:
+    mov     r0, r1
+.Lflush_segment:
+    mcr     CP15_REG7_CLEAN_FLUSH_DCACHE_ENTRY_BY_INDEX(r0)
+    adds    r0, r0, #0x40000000
+    bcc     .Lflush_segment
+    add     r1, r1, #CACHE_LINE_SIZE
+    cmp     r1, #(DCACHE_SIZE / ENTRIES_PER_SEGMENT)
+    bne     .Lflush_line
+    mov     r0, #0
+    mcr     CP15_REG7_DRAIN_WRITE_BUFFER
+    bx      lr
+
+// void cache_disable(void);
+//
+// Write back the data cache, then turn it and the protection unit off, as
+// the loaded program expects to find them.
+    .global cache_disable
+    .section .text.cache_disable, "ax", %progbits
+    .type cache_disable, %function
+cache_disable:
+    mov     r12, lr
+    bl      dc_flush_all
+    mrc     CP15_REG1_CONTROL_REGISTER(r0)
+    bic     r0, r0, #(CP15_CONTROL_DCACHE_ENABLE | CP15_CONTROL_PROTECTION_UNIT_ENABLE)
+    mcr     CP15_REG1_CONTROL_REGISTER(r0)
+    bx      r12
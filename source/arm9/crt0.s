@@ -22,6 +22,14 @@ _start:
     ldr pc, =0xFFFF0018
     ldr pc, =0xFFFF001C
 
+#ifdef PACK
+    // Image layout, for tools/ndspack (-s).
+    .word 0x394B504D // "MPK9" in ASCII
+    .word __pack_head_size
+    .word __dldi_start - _start
+    .word __itcm_size
+#endif
+
     .pool
 
 .Lstart_real:
@@ -71,12 +79,68 @@ _dma_clear:
     // r1 = source (_start in RAM)
     // r0 = ITCM start
     mov r11, r0
+#ifdef PACK
+    // The image is packed: the code up to __pack_start is followed by the
+    // DLDI area, which is left as is for DLDI patching, then by the rest
+    // of the code as an LZ77 stream.
+    ldr r2, =__pack_head_size
+.Lhead_copy:
+    subs r2, r2, #4
+    ldrge r3, [r1], #4
+    strge r3, [r0], #4
+    bgt .Lhead_copy
+
+    ldr r12, =__dldi_start
+    ldr r2, =__dldi_chunks
+.Ldldi_copy:
+    subs r2, r2, #1
+    ldmiage r1!, {r3-r10}
+    stmiage r12!, {r3-r10}
+    bgt .Ldldi_copy
+
+    // Unpack the rest, right after the code copied first.
+    // r1 = LZ77 stream, r0 = __pack_start in ITCM
+    ldr r2, [r1], #4
+    add r2, r0, r2, lsr #8
+.Lunpack_flags:
+    // Keep the flag byte in the top bits of r3, followed by a marker bit,
+    // which is shifted out after 8 tokens.
+    ldrb r3, [r1], #1
+    mov r3, r3, lsl #24
+    orr r3, r3, #0x800000
+.Lunpack_token:
+    cmp r0, r2
+    bhs .Lunpack_done
+    lsls r3, r3, #1
+    beq .Lunpack_flags
+    ldrb r4, [r1], #1
+    bcs .Lunpack_match
+    strb r4, [r0], #1
+    b .Lunpack_token
+.Lunpack_match:
+    // 4 bits of length - 3, 12 bits of distance - 1.
+    ldrb r5, [r1], #1
+    and r6, r4, #0xF
+    orr r5, r5, r6, lsl #8
+    sub r5, r0, r5
+    sub r5, r5, #1
+    mov r4, r4, lsr #4
+    add r4, r4, #3
+.Lunpack_copy:
+    ldrb r6, [r5], #1
+    strb r6, [r0], #1
+    subs r4, r4, #1
+    bgt .Lunpack_copy
+    b .Lunpack_token
+.Lunpack_done:
+#else
     ldr r2, =__itcm_chunks
 .Litcm_copy:
     subs r2, r2, #1
     ldmiage r1!, {r3-r10}
     stmiage r0!, {r3-r10}
     bgt .Litcm_copy
+#endif
 
     // Return to _start, now in the correct memory location.
     bx r11
@@ -103,6 +167,38 @@ _dma_clear:
     // Drain the write buffer, too, just in case.
     mcr CP15_REG7_DRAIN_WRITE_BUFFER
 
+    // Set up the protection unit for loading: region 0 covers everything,
+    // uncached; region 1 makes main RAM (but not its mirrors, which hold
+    // the data shared with the ARM7) cached and write-back. The other
+    // regions may be left over from the previous program.
+    ldr r0, =(0x00000000 | CP15_REGION_SIZE_4GB | CP15_CONFIG_REGION_ENABLE)
+    mcr CP15_REG6_PROTECTION_REGION(r0, 0)
+    ldr r0, =(0x02000000 | CP15_REGION_SIZE_4MB | CP15_CONFIG_REGION_ENABLE)
+    mcr CP15_REG6_PROTECTION_REGION(r0, 1)
+    mov r0, #0
+    mcr CP15_REG6_PROTECTION_REGION(r0, 2)
+    mcr CP15_REG6_PROTECTION_REGION(r0, 3)
+    mcr CP15_REG6_PROTECTION_REGION(r0, 4)
+    mcr CP15_REG6_PROTECTION_REGION(r0, 5)
+    mcr CP15_REG6_PROTECTION_REGION(r0, 6)
+    mcr CP15_REG6_PROTECTION_REGION(r0, 7)
+    mcr CP15_REG2_INSTRUCTION_CACHE_CONFIG(r0)
+    ldr r0, =(CP15_AREA_ACCESS_PERMISSIONS_PRW_UNO(0) | CP15_AREA_ACCESS_PERMISSIONS_PRW_UNO(1))
+    mcr CP15_REG5_DATA_ACCESS_PERMISSION(r0)
+    mcr CP15_REG5_INSTRUCTION_ACCESS_PERMISSION(r0)
+    mov r0, #CP15_CONFIG_AREA_IS_CACHABLE(1)
+    mcr CP15_REG2_DATA_CACHE_CONFIG(r0)
+    mov r0, #CP15_CONFIG_AREA_IS_BUFFERABLE(1)
+    mcr CP15_REG3_WRITE_BUFFER_CONTROL(r0)
+
+    // Enable the PU and DCache.
+    ldr r0, =(CP15_CONTROL_ITCM_ENABLE \
+        | CP15_CONTROL_DTCM_ENABLE \
+        | CP15_CONTROL_DCACHE_ENABLE \
+        | CP15_CONTROL_PROTECTION_UNIT_ENABLE \
+        | CP15_CONTROL_RESERVED_SBO_MASK)
+    mcr CP15_REG1_CONTROL_REGISTER(r0)
+
     // Clear BSS in DTCM.
     // r6 = BSS start (DTCM start)
     ldr r1, =__bss_chunks
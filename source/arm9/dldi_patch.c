@@ -7,14 +7,19 @@
 #include "dldi_patch.h"
 #include "aeabi.h"
 #include "console.h"
+#include "ipc.h"
 
 #define XOR_CONSTANT_VALUE 0xAA55AA55
-#define OBFUSCATED_COMPARE(a, b) \
-	(xor_constant(a, XOR_CONSTANT_VALUE) == (( \
+#define OBFUSCATED(b) (( \
 		(((b) & 0xFF000000) >> 24) | \
 		(((b) & 0xFF0000) >> 8) | \
 		(((b) & 0xFF00) << 8) | \
-		(((b) & 0xFF) << 24)) ^ XOR_CONSTANT_VALUE))
+		(((b) & 0xFF) << 24)) ^ XOR_CONSTANT_VALUE)
+#define OBFUSCATED_COMPARE(a, b) \
+	(xor_constant(a, XOR_CONSTANT_VALUE) == OBFUSCATED(b))
+// The in-memory value of b, computed at run time so that it never appears
+// as a constant.
+#define OBFUSCATED_VALUE(b) xor_constant(OBFUSCATED(b), XOR_CONSTANT_VALUE)
 
 static void dldi_relocate(DLDI_INTERFACE *io, void *targetAddress) {
     uint32_t offset;
@@ -85,27 +90,112 @@ static void dldi_relocate(DLDI_INTERFACE *io, void *targetAddress) {
     }
 }
 
-int dldi_patch_relocate(void *buffer, uint32_t size, DLDI_INTERFACE *driver) {
-    uint32_t *data = (uint32_t*) buffer;
-    for (; size; size -= 4, data++) {
-        // Obfuscate the constants, so that DLDI patchers don't catch the DLDI patching code.
-        if (OBFUSCATED_COMPARE(data[0], 0xEDA58DBF) && OBFUSCATED_COMPARE(data[1], 0x20436869) && OBFUSCATED_COMPARE(data[2], 0x73686d00)) {
-            dprintf("DLDI found at %d\n", (uint8_t*)data - (uint8_t*)buffer);
-            DLDI_INTERFACE *target = (DLDI_INTERFACE*) data;
-
-            uint8_t allocatedSize = target->allocatedSize;
-            if (allocatedSize < driver->driverSize) return DLPR_NOT_ENOUGH_SPACE;
-
-            void *targetAddress = target->dldiStart;
-
-            // Skip overwriting the magic number - the driver included as part of miniboot
-            // does not always contain it, to evade auto-DLDI patchers in previous stage bootloaders.
-            __aeabi_memcpy(((uint8_t*) target) + 4, ((uint8_t*) driver) + 4, (1 << allocatedSize) - 4);
-            target->allocatedSize = allocatedSize;
-            dldi_relocate(target, targetAddress);
-            return DLPR_OK;
+static struct {
+    uint8_t *buffer;
+    uint32_t *data;  // Next word to scan.
+    uint32_t *end;   // End of the binary.
+    uint32_t key[3];
+    bool arm7_scanning;
+    DLDI_INTERFACE *driver;
+    DLDI_INTERFACE *target; // Stub found, but not yet fully loaded.
+} patch;
+
+void dldi_patch_begin(void *buffer, uint32_t size, DLDI_INTERFACE *driver) {
+    patch.buffer = buffer;
+    patch.data = (uint32_t*) buffer;
+    patch.end = patch.data + (size >> 2);
+    // Obfuscate the constants, so that DLDI patchers don't catch the DLDI patching code.
+    patch.key[0] = OBFUSCATED_VALUE(0xEDA58DBF);
+    patch.key[1] = OBFUSCATED_VALUE(0x20436869);
+    patch.key[2] = OBFUSCATED_VALUE(0x73686d00);
+    patch.arm7_scanning = false;
+    patch.driver = driver;
+    patch.target = NULL;
+}
+
+static DLDI_INTERFACE *dldi_find(uint32_t *data, uint32_t *limit) {
+    // Only check the rest of the magic where the first word matches.
+    for (; (data = dldi_scan(data, (uint8_t*) limit - (uint8_t*) data, patch.key[0])) != NULL; data++) {
+        if (data[1] == patch.key[1] && data[2] == patch.key[2])
+            return (DLDI_INTERFACE*) data;
+    }
+    return NULL;
+}
+
+int dldi_patch_update(void *loaded) {
+    bool final = (uint32_t*) loaded >= patch.end;
+
+    if (!patch.target) {
+        // Only scan words whose first 16 bytes (magic and allocated size)
+        // have arrived; after the last chunk, scan to the end.
+        uint32_t *limit = final ? patch.end : ((uint32_t*) (((uintptr_t) loaded) & ~3)) - 3;
+
+        // Collect the ARM7's result for the previous range first, so that
+        // the first match in the binary is the one which gets patched.
+        if (patch.arm7_scanning) {
+            patch.arm7_scanning = false;
+            patch.target = (DLDI_INTERFACE*) ipc_arm7_scan_result(PHASE_DLDI_PATCH);
+        }
+
+        if (!patch.target && patch.data < limit) {
+            // While loading, the ARM7 scans each new range while the ARM9
+            // reads the next one. After the last chunk, the ARM9 scans the
+            // lower half of what is left, and the ARM7 the upper half.
+            uint32_t *split = final ? patch.data + ((limit - patch.data) >> 1) : patch.data;
+            ipc_arm7_wait(PHASE_DLDI_PATCH);
+            ipc_arm7_scan(split, (uint8_t*) limit - (uint8_t*) split, patch.key);
+            patch.arm7_scanning = true;
+            patch.target = dldi_find(patch.data, split);
+            patch.data = limit;
+
+            if (final) {
+                DLDI_INTERFACE *arm7_target = (DLDI_INTERFACE*) ipc_arm7_scan_result(PHASE_DLDI_PATCH);
+                patch.arm7_scanning = false;
+                if (!patch.target) patch.target = arm7_target;
+            }
         }
+
+        if (!patch.target) return DLPR_OK;
+        dprintf("DLDI found at %d\n", (uint8_t*) patch.target - patch.buffer);
     }
 
+    DLDI_INTERFACE *target = patch.target;
+    DLDI_INTERFACE *driver = patch.driver;
+    uint8_t allocatedSize = target->allocatedSize;
+    if (allocatedSize < driver->driverSize) return DLPR_NOT_ENOUGH_SPACE;
+
+    // Patch as soon as the stub's whole allocated area has been loaded.
+    if (!final && (uint8_t*) loaded < ((uint8_t*) target) + (1 << allocatedSize)) return DLPR_OK;
+    patch.target = NULL;
+    patch.data = patch.end;
+
+    void *targetAddress = target->dldiStart;
+
+    // Skip overwriting the magic number - the driver included as part of miniboot
+    // does not always contain it, to evade auto-DLDI patchers in previous stage bootloaders.
+    __aeabi_memcpy(((uint8_t*) target) + 4, ((uint8_t*) driver) + 4, (1 << allocatedSize) - 4);
+    target->allocatedSize = allocatedSize;
+    dldi_relocate(target, targetAddress);
     return DLPR_OK;
 }
+
+int dldi_patch_relocate(void *buffer, uint32_t size, DLDI_INTERFACE *driver) {
+    dldi_patch_begin(buffer, size, driver);
+    return dldi_patch_update(((uint8_t*) buffer) + size);
+}
+
+#ifdef BENCHMARK_DLDI_SCAN
+void dldi_scan_benchmark(void *buffer, uint32_t size) {
+    uint32_t *data = (uint32_t*) buffer;
+    uint32_t start = timing_ticks();
+    // The previous scanning loop: one out-of-line compare per word.
+    for (uint32_t i = 0; i < (size >> 2); i++) {
+        if (OBFUSCATED_COMPARE(data[i], 0xEDA58DBF) && OBFUSCATED_COMPARE(data[i + 1], 0x20436869) && OBFUSCATED_COMPARE(data[i + 2], 0x73686d00))
+            break;
+    }
+    uint32_t mid = timing_ticks();
+    dldi_scan(data, size & ~3, OBFUSCATED_VALUE(0xEDA58DBF));
+    uint32_t end = timing_ticks();
+    eprintf("DLDI scan: %u us, was %u us\n", timing_ticks_to_us(end - mid), timing_ticks_to_us(mid - start));
+}
+#endif
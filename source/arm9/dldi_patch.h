@@ -11,6 +11,18 @@
 #define DLPR_OK                  0
 #define DLPR_NOT_ENOUGH_SPACE    1
 
+// Time the DLDI signature scan against the previous per-word loop.
+// #define BENCHMARK_DLDI_SCAN
+
+/**
+ * @brief Find the first word equal to key.
+ *
+ * @param data The word-aligned buffer to scan.
+ * @param size The size of the buffer, in bytes; a multiple of 4.
+ * @return uint32_t* The first matching word, or NULL.
+ */
+uint32_t *dldi_scan(const uint32_t *data, uint32_t size, uint32_t key);
+
 /**
  * @brief Patch a binary's DLDI driver, if any.
  * 
@@ -21,4 +33,32 @@
  */
 int dldi_patch_relocate(void *buffer, uint32_t size, DLDI_INTERFACE *driver);
 
+/**
+ * @brief Start patching a binary's DLDI driver while the binary is loaded.
+ *
+ * The binary is scanned by dldi_patch_update() as it arrives, and patched
+ * as soon as the stub's whole allocated area has been loaded.
+ *
+ * @param buffer The buffer the binary is loaded to.
+ * @param size The size of the binary, in bytes.
+ * @param driver Source DLDI driver.
+ */
+void dldi_patch_begin(void *buffer, uint32_t size, DLDI_INTERFACE *driver);
+
+/**
+ * @brief Scan the newly loaded part of a binary, and patch it if possible.
+ *
+ * @param loaded The end of the data loaded so far, in order from the start
+ * of the buffer. Once it reaches the end of the binary, scanning finishes.
+ * @return int The error code, if any.
+ */
+int dldi_patch_update(void *loaded);
+
+#ifdef BENCHMARK_DLDI_SCAN
+/**
+ * @brief Print the time dldi_scan() and the previous loop take on a binary.
+ */
+void dldi_scan_benchmark(void *buffer, uint32_t size);
+#endif
+
 #endif /* __DLDI_PATCH_H__ */
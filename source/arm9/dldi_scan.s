@@ -0,0 +1,62 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+    .arm
+    .syntax unified
+
+// uint32_t *dldi_scan(const uint32_t *data, uint32_t size, uint32_t key);
+//
+// Find the first word equal to key, or return NULL. size is in bytes, and
+// a multiple of 4. Eight words are compared per ldm; only when one of them
+// matches is the block rescanned to find which.
+    .global dldi_scan
+    .section .text.dldi_scan, "ax", %progbits
+    .type dldi_scan, %function
+dldi_scan:
+    push    {r4-r10}
+    subs    r1, r1, #32
+    blo     .Ltail
+
+.Lloop_32:
+    ldmia   r0!, {r3-r10}
+    cmp     r3, r2
+    cmpne   r4, r2
+    cmpne   r5, r2
+    cmpne   r6, r2
+    cmpne   r7, r2
+    cmpne   r8, r2
+    cmpne   r9, r2
+    cmpne   r10, r2
+    beq     .Lhit
+    subs    r1, r1, #32
+    bhs     .Lloop_32
+
+.Ltail:
+    // < 32 bytes remaining
+    adds    r1, r1, #32
+    beq     .Lnone
+.Lloop_4:
+    ldr     r3, [r0], #4
+    cmp     r3, r2
+    beq     .Lfound
+    subs    r1, r1, #4
+    bne     .Lloop_4
+
+.Lnone:
+    mov     r0, #0
+    pop     {r4-r10}
+    bx      lr
+
+.Lhit:
+    // One of the last eight words matched.
+    sub     r0, r0, #32
+.Lhit_loop:
+    ldr     r3, [r0], #4
+    cmp     r3, r2
+    bne     .Lhit_loop
+
+.Lfound:
+    sub     r0, r0, #4
+    pop     {r4-r10}
+    bx      lr
@@ -1,9 +1,70 @@
 #include <stdbool.h>
 #include "../../../fatfs/source/ff.h"			/* Obtains integer types */
+#include "aeabi.h"
+#include "cache.h"
+#include "cp15_asm.h"
 #include "dldi.h"
+#include "diskio_stats.h"
 #include "../../../fatfs/source/diskio.h"		/* Declarations of disk functions */
 
 static DSTATUS status = STA_NOINIT;
+disk_stats_t disk_stats;
+
+static bool dldi_read (
+	BYTE *buff,
+	LBA_t sector,
+	UINT count
+) {
+	disk_stats.commands++;
+	disk_stats.sectors += count;
+	/* The driver may write to the buffer with DMA, bypassing the cache.
+	   Past the cache's size, flushing all of it takes fewer operations. */
+	if (count * FF_MIN_SS >= DCACHE_SIZE)
+		dc_flush_all();
+	else
+		dc_flush_range(buff, count * FF_MIN_SS);
+	return _io_dldi_stub.readSectors(sector, count, buff);
+}
+
+#if FF_WF_MARK_WINDOW_READS
+/* Set-associative cache for window (FAT, directory, boot sector) reads.
+   Bulk data reads bypass it. The sector data is kept in VRAM bank B,
+   after the DLDI driver copy and the BOOT.NDS link map. */
+#define CACHE_SETS		16
+#define CACHE_WAYS		4
+#define CACHE_DATA		((uint8_t*) 0x6828000)
+#define CACHE_LINE(set, way)	(CACHE_DATA + (((set) * CACHE_WAYS + (way)) * FF_MIN_SS))
+
+static LBA_t cache_tags[CACHE_SETS][CACHE_WAYS]; /* Sector + 1; 0 if empty */
+static BYTE cache_next[CACHE_SETS];
+
+static DRESULT disk_read_cached (
+	BYTE *buff,
+	LBA_t sector
+) {
+	UINT set = sector & (CACHE_SETS - 1);
+	UINT way;
+
+	for (way = 0; way < CACHE_WAYS; way++) {
+		if (cache_tags[set][way] == sector + 1) {
+			disk_stats.cache_hits++;
+			__aeabi_memcpy4(buff, CACHE_LINE(set, way), FF_MIN_SS);
+			return RES_OK;
+		}
+	}
+
+	disk_stats.cache_misses++;
+	if (!dldi_read(buff, sector, 1))
+		return RES_ERROR;
+
+	/* Replace entries within a set in round-robin order. */
+	way = cache_next[set];
+	cache_next[set] = (way + 1) & (CACHE_WAYS - 1);
+	cache_tags[set][way] = sector + 1;
+	__aeabi_memcpy4(CACHE_LINE(set, way), buff, FF_MIN_SS);
+	return RES_OK;
+}
+#endif
 
 DSTATUS disk_status(BYTE pdrv) {
 	return status;
@@ -26,7 +87,14 @@ DRESULT disk_read (
 	LBA_t sector,	/* Start sector in LBA */
 	UINT count		/* Number of sectors to read */
 ) {
-	if (!_io_dldi_stub.readSectors(sector, count, buff))
+#if FF_WF_MARK_WINDOW_READS
+	/* VRAM does not support byte writes, so only cache word-aligned
+	   buffers; the FATFS window always is. */
+	if ((pdrv & 0x80) && count == 1 && !(((uintptr_t) buff) & 3))
+		return disk_read_cached(buff, sector);
+#endif
+
+	if (!dldi_read(buff, sector, count))
 		return RES_ERROR;
 	return RES_OK;
 }
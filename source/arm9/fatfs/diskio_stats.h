@@ -0,0 +1,22 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __DISKIO_STATS_H__
+#define __DISKIO_STATS_H__
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t commands;     // DLDI readSectors() calls
+    uint32_t sectors;      // Sectors read through DLDI
+    uint32_t cache_hits;   // Window reads served by the sector cache
+    uint32_t cache_misses; // Window reads which missed the sector cache
+} disk_stats_t;
+
+/**
+ * Disk I/O statistics.
+ */
+extern disk_stats_t disk_stats;
+
+#endif /* __DISKIO_STATS_H__ */
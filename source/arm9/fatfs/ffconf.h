@@ -50,8 +50,9 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_FASTSEEK	0
-/* This option switches fast seek function. (0:Disable or 1:Enable) */
+#define FF_USE_FASTSEEK	1
+/* This option switches fast seek function. (0:Disable or 1:Enable)
+/  miniboot builds a cluster link map for BOOT.NDS in VRAM when enabled. */
 
 
 #define FF_USE_EXPAND	0
@@ -359,7 +360,7 @@
 */
 
 
-#define FF_WF_MARK_WINDOW_READS 0
+#define FF_WF_MARK_WINDOW_READS 1
 /* FF_WF_MARK_WINDOW_READS allows marking reads done on the FATFS instance's
 /  window (directory/cluster reads) with an "| 0x80" on the pdrv argument
 /  in disk_read(). This can be used as information for sector caching
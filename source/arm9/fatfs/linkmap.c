@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#include "common.h"
+#include "ff.h"
+#include "diskio.h"
+#include "linkmap.h"
+
+#if FF_USE_FASTSEEK
+
+// Additional FAT sectors to prefetch past the end of an unfragmented chain,
+// to also cover files with a few nearby fragments.
+#define PREFETCH_SLACK_SECTORS 4
+
+FRESULT linkmap_create(FIL *fp, DWORD *tbl, void *scratch, UINT scratch_size) {
+    FATFS *fs = fp->obj.fs;
+    DWORD clst = fp->obj.sclust;
+    DWORD bcs = (DWORD) fs->csize * FF_MAX_SS;
+    DWORD nclst = (fp->obj.objsize + bcs - 1) / bcs;
+
+    fp->cltbl = tbl;
+    if ((fs->fs_type != FS_FAT16 && fs->fs_type != FS_FAT32) || clst < 2 || !nclst)
+        return f_lseek(fp, CREATE_LINKMAP);
+
+    // Read the FAT sectors covering the chain, assuming it is contiguous.
+    UINT shift = fs->fs_type == FS_FAT32 ? 2 : 1;
+    DWORD first = (clst << shift) / FF_MAX_SS;
+    DWORD count = ((clst + nclst) << shift) / FF_MAX_SS - first + 1 + PREFETCH_SLACK_SECTORS;
+    count = MIN(count, MIN(scratch_size / FF_MAX_SS, fs->fsize - first));
+    if (disk_read(fs->pdrv, scratch, fs->fatbase + first, count) != RES_OK)
+        return FR_DISK_ERR;
+    DWORD base = first * (FF_MAX_SS >> shift);
+    DWORD limit = count * (FF_MAX_SS >> shift);
+
+    // Walk the chain, writing (length, start cluster) pairs.
+    DWORD *t = tbl + 1;
+    DWORD ulen = 2;
+    DWORD sclst = clst;
+    DWORD ncl = 0;
+    while (true) {
+        ncl++;
+        if (!--nclst) break;
+
+        // The chain leaves the prefetched range.
+        if (clst - base >= limit)
+            return f_lseek(fp, CREATE_LINKMAP);
+
+        DWORD next = shift == 2
+            ? (((DWORD*) scratch)[clst - base] & 0x0FFFFFFF)
+            : ((WORD*) scratch)[clst - base];
+        if (next < 2 || next >= fs->n_fatent)
+            return FR_INT_ERR;
+
+        if (next != clst + 1) {
+            if ((ulen += 2) > tbl[0])
+                return FR_NOT_ENOUGH_CORE;
+            *t++ = ncl;
+            *t++ = sclst;
+            sclst = next;
+            ncl = 0;
+        }
+        clst = next;
+    }
+
+    if ((ulen += 2) > tbl[0])
+        return FR_NOT_ENOUGH_CORE;
+    *t++ = ncl;
+    *t++ = sclst;
+    *t = 0;
+    tbl[0] = ulen;
+    return FR_OK;
+}
+
+FRESULT linkmap_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+    FATFS *fs = fp->obj.fs;
+    uint8_t *dst = buff;
+    FSIZE_t ofs = fp->fptr;
+    FRESULT res;
+    UINT n;
+
+    if (!fp->cltbl)
+        return f_read(fp, buff, btr, br);
+
+    *br = 0;
+    btr = MIN(btr, fp->obj.objsize - ofs);
+    while (btr) {
+        if ((ofs % FF_MAX_SS) || btr < FF_MAX_SS) {
+            // Partial sector: go through the FatFs window.
+            n = MIN(btr, FF_MAX_SS - (ofs % FF_MAX_SS));
+            if ((res = f_lseek(fp, ofs)) != FR_OK) return res;
+            if ((res = f_read(fp, dst, n, &n)) != FR_OK) return res;
+            if (!n) return FR_INT_ERR;
+        } else {
+            // Find the fragment containing this offset.
+            DWORD sect = ofs / FF_MAX_SS;
+            DWORD cl = sect / fs->csize;
+            DWORD csect = sect & (fs->csize - 1);
+            DWORD *t = fp->cltbl + 1;
+            while (cl >= t[0]) {
+                if (!t[0]) return FR_INT_ERR;
+                cl -= t[0];
+                t += 2;
+            }
+
+            // Read as many whole sectors as the fragment allows.
+            DWORD count = MIN((t[0] - cl) * fs->csize - csect, btr / FF_MAX_SS);
+            if (disk_read(fs->pdrv, dst, fs->database + (t[1] + cl - 2) * fs->csize + csect, count) != RES_OK)
+                return FR_DISK_ERR;
+            n = count * FF_MAX_SS;
+        }
+        ofs += n;
+        dst += n;
+        btr -= n;
+        *br += n;
+    }
+
+    // Bring the FatFs file pointer up to date.
+    return f_lseek(fp, ofs);
+}
+
+#endif
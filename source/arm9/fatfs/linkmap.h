@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __LINKMAP_H__
+#define __LINKMAP_H__
+
+#include "ff.h"
+
+#if FF_USE_FASTSEEK
+
+/**
+ * @brief Create a FatFs fast seek cluster link map for an open file.
+ *
+ * The FAT sectors covering the file's cluster chain are read with a single
+ * disk_read() call and walked in memory. If the chain leaves the prefetched
+ * range, or the volume is FAT12, this falls back to f_lseek(CREATE_LINKMAP).
+ *
+ * @param fp The open file; fp->cltbl is set to tbl.
+ * @param tbl The link map table; tbl[0] must contain its size in words.
+ * @param scratch Scratch buffer for FAT sectors.
+ * @param scratch_size Size of the scratch buffer, in bytes.
+ * @return FRESULT FR_OK on success. On failure, fast seek must not be used.
+ */
+FRESULT linkmap_create(FIL *fp, DWORD *tbl, void *scratch, UINT scratch_size);
+
+/**
+ * @brief Read data from a file with a link map, like f_read().
+ *
+ * Whole sectors are read directly from each fragment of the file with
+ * the largest possible disk_read() calls; partial sectors go through FatFs.
+ * Falls back to f_read() if the file has no link map.
+ */
+FRESULT linkmap_read(FIL *fp, void *buff, UINT btr, UINT *br);
+
+#else
+
+#define linkmap_read f_read
+
+#endif
+
+#endif /* __LINKMAP_H__ */
@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+/* ARM9 side of the ARM7 stage3 command protocol. */
+
+#include "cache.h"
+#include "cpsr_asm.h"
+#include "ipc.h"
+
+uint32_t arm7_bytes_copied = 0;
+ipc_latency_t ipc_latency;
+static bool arm7_busy = false;
+static uint32_t job_head = 0;      // Jobs queued
+static uint32_t job_submitted = 0; // Jobs handed to the ARM7
+
+void ipc_irq_init(void) {
+    asm volatile ("msr cpsr_c, %0" :: "i"(CPSR_I | CPSR_F | CPSR_SYSTEM));
+    REG_IE = IRQ_IPC_SYNC;
+    REG_IF = ~0;
+    REG_IME = 1;
+}
+
+void ipc_irq_exit(void) {
+    REG_IME = 0;
+    REG_IE = 0;
+    REG_IF = ~0;
+    REG_IPCSYNC &= IPCSYNC_OUTPUT(0xF);
+}
+
+static void ipc_latency_add(uint32_t ticks) {
+    ipc_latency.count++;
+    ipc_latency.total += ticks;
+    if (ticks > ipc_latency.max) ipc_latency.max = ticks;
+}
+
+int ipc_arm7_sync(void) {
+    uint32_t start = timing_ticks();
+    for (int i = 1; i <= IPC_SYNC_STEPS + 1; i++) {
+        // stage2 answers steps 1 to IPC_SYNC_STEPS with their number. It
+        // then hands over to stage3, which waits for IPC_ARM7_NONE and only
+        // then answers with IPC_SYNC_STEPS + 1.
+        REG_IPCSYNC = i <= IPC_SYNC_STEPS ? (i << 8) : IPC_ARM7_NONE;
+        // The ARM7 may not have started yet, so it can't be expected to
+        // raise the IRQ: poll, with a timeout.
+        uint32_t now;
+        while ((REG_IPCSYNC & 0xF) != i) {
+            now = timing_ticks();
+            if (now - start >= IPC_SYNC_TIMEOUT)
+                return i;
+        }
+        now = timing_ticks();
+        if (i == 1) ipc_latency.sync_ticks = now - start;
+        else ipc_latency_add(now - start);
+        start = now;
+    }
+    return 0;
+}
+
+void ipc_arm7_cmd(uint32_t cmd) {
+    uint32_t start = timing_ticks();
+    uint32_t last_sync = REG_IPCSYNC & 0xF;
+    REG_IPCSYNC = cmd | IPCSYNC_IRQ_REQUEST | IPCSYNC_IRQ_ENABLE;
+    while (true) {
+        // Acknowledge the IRQ before checking, so that a reply arriving in
+        // between still ends the wait.
+        REG_IF = IRQ_IPC_SYNC;
+        if ((REG_IPCSYNC & 0xF) != last_sync) break;
+        asm volatile ("mcr p15, 0, %0, c7, c0, 4" :: "r"(0));
+    }
+    if (cmd != IPC_ARM7_NONE)
+        ipc_latency_add(timing_ticks() - start);
+}
+
+void ipc_wram_map(uint8_t mapping) {
+    REG_WRAMCNT = mapping;
+}
+
+// Wait for the ARM7's current command to finish, so that it can accept
+// the next one.
+static void ipc_arm7_idle(void) {
+    if (!arm7_busy) return;
+    ipc_arm7_cmd(IPC_ARM7_NONE);
+    arm7_busy = false;
+}
+
+void ipc_arm7_queue(uint32_t op, uint32_t dest, uint32_t src, uint32_t size) {
+    ipc_job_ring_t *ring = IPC_JOB_RING;
+    if (!job_head) {
+        ring->done = 0;
+        ring->copy_ticks = 0;
+    }
+
+    // The ring is full: let the ARM7 drain it.
+    if (job_head - ring->done >= IPC_JOB_COUNT) {
+        ipc_arm7_submit();
+        ipc_arm7_idle();
+    }
+
+    ipc_job_t *job = &ring->jobs[job_head % IPC_JOB_COUNT];
+    job->op = op;
+    job->src = src;
+    job->dest = dest;
+    job->size = size;
+    if (op == IPC_JOB_COPY) arm7_bytes_copied += size;
+    job_head++;
+}
+
+void ipc_arm7_submit(void) {
+    if (job_submitted == job_head) return;
+    ipc_arm7_idle();
+    // Make everything the jobs read visible to the ARM7.
+    dc_flush_all();
+    REG_IPCFIFOSEND = (uint32_t) IPC_JOB_RING;
+    REG_IPCFIFOSEND = job_head;
+    ipc_arm7_cmd(IPC_ARM7_JOBS);
+    job_submitted = job_head;
+    arm7_busy = true;
+}
+
+void ipc_arm7_scan(const uint32_t *data, uint32_t size, const uint32_t *key) {
+    dc_flush_all();
+    REG_IPCFIFOSEND = (uint32_t) data;
+    REG_IPCFIFOSEND = size;
+    REG_IPCFIFOSEND = key[0];
+    REG_IPCFIFOSEND = key[1];
+    REG_IPCFIFOSEND = key[2];
+    ipc_arm7_cmd(IPC_ARM7_SCAN);
+    arm7_busy = true;
+}
+
+uint32_t *ipc_arm7_scan_result(boot_phase_t phase) {
+    // The ARM7 sends the result before acknowledging IPC_ARM7_NONE.
+    ipc_arm7_wait(phase);
+    return (uint32_t*) REG_IPCFIFORECV;
+}
+
+void ipc_arm7_wait(boot_phase_t phase) {
+    if (!arm7_busy) return;
+    timing_phase(phase);
+    ipc_arm7_idle();
+    // Drop any lines the ARM7 may have written behind the cache's back.
+    dc_flush_all();
+    timing_phase(PHASE_ARM7_WAIT);
+}
@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __IPC_H__
+#define __IPC_H__
+
+#include "common.h"
+#include "timing.h"
+
+#define IPC_ARM7_NONE  0x000
+#define IPC_ARM7_JOBS  0x100
+#define IPC_ARM7_RESET 0x200
+#define IPC_ARM7_SCAN  0x300
+#define IPC_ARM7_SYNC  0xF00
+
+/* === ARM7 job queue ===
+ *
+ * Bulk memory jobs are written to a ring in main RAM, which the ARM7 drains
+ * in order whenever it is handed a batch with IPC_ARM7_JOBS. The ring lies
+ * below the bootstub, out of reach of any binary the loader accepts; its
+ * layout is shared with source/arm7/stage3.s.
+ */
+
+#define IPC_JOB_COPY  0 // Copy size bytes from src to dest.
+#define IPC_JOB_FILL  1 // Fill size bytes at dest with the word src; size is a multiple of 4.
+#define IPC_JOB_CLEAR 2 // Fill size bytes at dest with zero; size is a multiple of 4.
+#define IPC_JOB_PACK  3 // Pack size bytes from src to dest, as below; size is a multiple of 4.
+
+/* IPC_JOB_PACK output: a word holding the unpacked size in bytes, followed
+ * by records. A record is a word count, followed by that many words; or,
+ * with bit 31 set, stands for that many zero words. Runs of fewer than
+ * three zero words are kept in the surrounding records, so at most
+ * size + 8 bytes are written. */
+
+#define IPC_JOB_COUNT 16
+
+typedef struct {
+    uint32_t op;
+    uint32_t src;
+    uint32_t dest;
+    uint32_t size; // In bytes
+} ipc_job_t;
+
+typedef struct {
+    ipc_job_t jobs[IPC_JOB_COUNT];
+    volatile uint32_t done;       // Number of jobs completed, written by the ARM7
+    volatile uint32_t copy_ticks; // Time spent on copy jobs, in timing.h ticks, written by the ARM7
+} ipc_job_ring_t;
+
+#define IPC_JOB_RING ((ipc_job_ring_t*) 0x2FF3E00)
+
+/* === Shared WRAM === */
+
+#define WRAM_ARM9      0 // All 32 KB to the ARM9
+#define WRAM_ARM9_HIGH 1 // Upper 16 KB to the ARM9, lower 16 KB to the ARM7
+#define WRAM_ARM9_LOW  2 // Lower 16 KB to the ARM9, upper 16 KB to the ARM7
+#define WRAM_ARM7      3 // All 32 KB to the ARM7
+
+/**
+ * @brief Map shared WRAM (WRAMCNT).
+ *
+ * Must not be called while the ARM7 is working on shared WRAM.
+ */
+void ipc_wram_map(uint8_t mapping);
+
+/**
+ * Total number of bytes handed to the ARM7 for copying.
+ */
+extern uint32_t arm7_bytes_copied;
+
+/* === ARM7 synchronization === */
+
+#define IPC_SYNC_STEPS   3             // Must match the stage2 loop in source/arm7/crt0.s
+#define IPC_SYNC_TIMEOUT (523656 / 2) // ~500 ms, in timing.h ticks
+
+typedef struct {
+    uint32_t sync_ticks; // Time until the ARM7 first answered the handshake
+    uint32_t count;      // Round trips measured since
+    uint32_t total;      // Their total time, in ticks
+    uint32_t max;        // The longest of them, in ticks
+} ipc_latency_t;
+
+/**
+ * Round-trip latency of IPCSYNC commands. Waits for the ARM7 to finish
+ * its previous command (IPC_ARM7_NONE) are not counted.
+ */
+extern ipc_latency_t ipc_latency;
+
+/**
+ * @brief Bring the ARM7 into lock-step, and hand it over to stage3.
+ *
+ * Each handshake step must be answered with the exact step number within
+ * IPC_SYNC_TIMEOUT of the previous one.
+ *
+ * @return int 0 on success, or the step at which the ARM7 stopped answering.
+ */
+int ipc_arm7_sync(void);
+
+/**
+ * @brief Enable the IPC sync IRQ, so that waits for the ARM7 can sleep.
+ *
+ * The IRQ only wakes the CPU up; it is masked in the CPSR and never taken.
+ */
+void ipc_irq_init(void);
+
+/**
+ * @brief Disable all IRQs again, before handing over to the loaded program.
+ */
+void ipc_irq_exit(void);
+
+/**
+ * @brief Send a command to the ARM7, and wait until it has been received.
+ */
+void ipc_arm7_cmd(uint32_t cmd);
+
+/**
+ * @brief Queue a job for the ARM7, without handing it over yet.
+ *
+ * If the ring is full, this submits the queued jobs and waits for the ARM7
+ * to finish them.
+ */
+void ipc_arm7_queue(uint32_t op, uint32_t dest, uint32_t src, uint32_t size);
+
+/**
+ * @brief Hand all queued jobs to the ARM7 as one batch.
+ *
+ * Returns as soon as the ARM7 has received the batch; all jobs are
+ * finished once ipc_arm7_wait() returns.
+ */
+void ipc_arm7_submit(void);
+
+/**
+ * @brief Ask the ARM7 to copy a chunk of memory.
+ *
+ * Returns as soon as the ARM7 has received the request; the copy is
+ * finished once ipc_arm7_wait() returns.
+ */
+static inline void ipc_arm7_copy(uint32_t dest, uint32_t src, uint32_t size) {
+    ipc_arm7_queue(IPC_JOB_COPY, dest, src, size);
+    ipc_arm7_submit();
+}
+
+/**
+ * @brief Ask the ARM7 to find the first occurrence of three words.
+ *
+ * Returns as soon as the ARM7 has received the request; the result has to
+ * be collected with ipc_arm7_scan_result().
+ *
+ * @param data The word-aligned start of the range to scan.
+ * @param size The size of the range, in bytes; a multiple of 4.
+ * @param key The three consecutive words to look for.
+ */
+void ipc_arm7_scan(const uint32_t *data, uint32_t size, const uint32_t *key);
+
+/**
+ * @brief Wait for the result of ipc_arm7_scan().
+ *
+ * @param phase The phase the time up to this point is attributed to.
+ * @return uint32_t* The first matching word, or NULL.
+ */
+uint32_t *ipc_arm7_scan_result(boot_phase_t phase);
+
+/**
+ * @brief Wait for the ARM7 to finish its current command, if any.
+ *
+ * @param phase The phase the time up to this point is attributed to.
+ */
+void ipc_arm7_wait(boot_phase_t phase);
+
+#endif /* __IPC_H__ */
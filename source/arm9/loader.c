@@ -0,0 +1,334 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+/* BOOT.NDS loading: header validation, binary loading and DLDI patching. */
+
+#include "common.h"
+#include "console.h"
+#include "dldi_patch.h"
+#include "ipc.h"
+#include "linkmap.h"
+#include "loader.h"
+#include "lz77.h"
+#include "ndspack.h"
+#include "timing.h"
+
+// Cluster link map for BOOT.NDS, placed right after the DLDI driver copy.
+#define LINKMAP       ((DWORD*) 0x6824000)
+#define LINKMAP_SIZE  4096 // in words
+
+// Scratch space for prefetching the FAT; nothing has been loaded yet.
+#define LINKMAP_SCRATCH      SCRATCH_START
+#define LINKMAP_SCRATCH_SIZE SCRATCH_SIZE
+
+// The parts of ARM7 binaries in ARM7-only RAM are staged through free
+// main RAM, if there is enough of it, or else through shared WRAM, 16 KB
+// at a time: while the ARM7 copies a chunk out of its half, the ARM9 reads
+// the next one into the other. Whichever half the ARM9 has is visible at
+// WRAM_STAGING to it, and the ARM7's half to the ARM7.
+#define WRAM_STAGING       0x3000000
+#define ARM7_CHUNK_SIZE    0x4000
+#define ARM7_PRIVATE_RAM   0x3800000
+
+// The ARM9 binary is read in chunks of this size, each scanned for the
+// DLDI stub right after it has been read.
+#define ARM9_CHUNK_SIZE    0x10000
+
+// Packed binaries are read to free main RAM in chunks of this size, each
+// unpacked right after it has been read.
+#define PACKED_CHUNK_SIZE  0x8000
+
+static bool arm7_in_arm7_ram;
+static ndspack_header_t packed;
+
+void loader_open(FIL *fp) {
+#if FF_USE_FASTSEEK
+    // Build the cluster link map, so that seeks and reads no longer have
+    // to walk the FAT. If BOOT.NDS is too fragmented to fit in the
+    // table, fall back to regular cluster chain walking.
+    LINKMAP[0] = LINKMAP_SIZE;
+    if (linkmap_create(fp, LINKMAP, (void*) LINKMAP_SCRATCH, LINKMAP_SCRATCH_SIZE) == FR_OK) {
+        dprintf("Link map: %d fragments\n", (LINKMAP[0] - 1) >> 1);
+    } else {
+        fp->cltbl = NULL;
+    }
+#endif
+}
+
+void loader_read_header(FIL *fp) {
+    unsigned int bytes_read;
+
+    // Read the .nds file header, and the packing extension after it.
+    checkErrorFatFs("Could not read BOOT.NDS", f_read(fp, NDS_HEADER, sizeof(nds_header_t), &bytes_read));
+    checkErrorFatFs("Could not read BOOT.NDS", f_read(fp, &packed, sizeof(packed), &bytes_read));
+    if (bytes_read != sizeof(packed) || packed.magic != NDSPACK_MAGIC)
+        packed.flags = 0;
+    if (!(packed.flags & NDSPACK_ARM9)) packed.arm9_packed_size = 0;
+    if (!(packed.flags & NDSPACK_ARM7)) packed.arm7_packed_size = 0;
+    if (packed.flags)
+        dprintf("Packed: ARM9 %d, ARM7 %d bytes\n", packed.arm9_packed_size, packed.arm7_packed_size);
+
+    // Validate the ARM7 binary location.
+    dprintf("ARM7: %d bytes @ %X\n", NDS_HEADER->arm7_size, NDS_HEADER->arm7_start);
+    bool arm7_in_main_ram = IN_RANGE_EX(NDS_HEADER->arm7_start, MAIN_RAM_START, MAIN_RAM_END);
+    arm7_in_arm7_ram = IN_RANGE_EX(NDS_HEADER->arm7_start, 0x37F8000, 0x380FE00);
+    if (!NDS_HEADER->arm7_size
+        || !IN_RANGE_EX(NDS_HEADER->arm7_entry - NDS_HEADER->arm7_start, 0, NDS_HEADER->arm7_size)
+        || (!arm7_in_main_ram && !arm7_in_arm7_ram)
+        || (arm7_in_main_ram && !IN_RANGE_EX(NDS_HEADER->arm7_start + NDS_HEADER->arm7_size, 0x2000001, 0x23BFE01))
+        || (arm7_in_arm7_ram && !IN_RANGE_EX(NDS_HEADER->arm7_start + NDS_HEADER->arm7_size, 0x37F8001, 0x380FE01))) {
+        eprintf("Invalid ARM7 binary location."); haltOnError();
+    }
+
+    // Validate the ARM9 binary location.
+    dprintf("ARM9: %d bytes @ %X\n", NDS_HEADER->arm9_size, NDS_HEADER->arm9_start);
+    if (!NDS_HEADER->arm9_size
+        || !IN_RANGE_EX(NDS_HEADER->arm9_entry - NDS_HEADER->arm9_start, 0, NDS_HEADER->arm9_size)
+        || !IN_RANGE_EX(NDS_HEADER->arm9_start, MAIN_RAM_START, MAIN_RAM_END)
+        || !IN_RANGE_EX(NDS_HEADER->arm9_start + NDS_HEADER->arm9_size, 0x2000001, 0x23BFE01)) {
+        eprintf("Invalid ARM9 binary location."); haltOnError();
+    }
+
+    if ((packed.flags & NDSPACK_ARM9 && packed.arm9_packed_size < 4)
+        || (packed.flags & NDSPACK_ARM7 && packed.arm7_packed_size < 4)) {
+        eprintf("Invalid packed binary size."); haltOnError();
+    }
+}
+
+/* === Load planning === */
+
+typedef struct {
+    uint32_t offset;  // Offset in BOOT.NDS.
+    uint32_t size;    // Size, in bytes.
+    uint32_t packed;  // Size in BOOT.NDS, if packed; 0 otherwise.
+    uint32_t address; // Destination address.
+    bool staged;      // Loaded to ARM7 RAM through shared WRAM?
+    uint8_t phase;    // Boot phase the load time is attributed to.
+} load_segment_t;
+
+/**
+ * @brief Order the ARM9 and ARM7 binary reads.
+ *
+ * The header is always read first, from offset 0. The remaining segments
+ * are read in file order, so that FatFs never has to seek backwards and
+ * walk the cluster chain again from the start of the file; the gap
+ * between them is skipped by a forward seek, which continues from the
+ * current cluster. Unpacked segments which are adjacent both in the file
+ * and in memory are merged into a single read.
+ *
+ * @param segments ARM9 and ARM7 segments, in this order.
+ * @return int The number of segments to load.
+ */
+static int load_plan(load_segment_t *segments) {
+    if (segments[1].offset < segments[0].offset) {
+        load_segment_t tmp = segments[0];
+        segments[0] = segments[1];
+        segments[1] = tmp;
+    }
+
+    if (!segments[0].staged && !segments[1].staged
+        && !segments[0].packed && !segments[1].packed
+        && segments[0].offset + segments[0].size == segments[1].offset
+        && segments[0].address + segments[0].size == segments[1].address) {
+        segments[0].size += segments[1].size;
+        return 1;
+    }
+
+    return 2;
+}
+
+static void dldi_patch_check(int result) {
+    if (result) {
+        eprintf("Failed to apply DLDI patch.\n");
+        switch (result) {
+            case DLPR_NOT_ENOUGH_SPACE: eprintf("Not enough space."); break;
+        }
+        haltOnError();
+    }
+}
+
+static bool ranges_overlap(uint32_t a, uint32_t a_size, uint32_t b, uint32_t b_size) {
+    return a < b + b_size && b < a + a_size;
+}
+
+uint32_t loader_free_ram_except(uint32_t size, uint32_t used, uint32_t used_size) {
+    uint32_t candidates[3] = {
+        (MAIN_RAM_END - size) & ~31,
+        (used - size) & ~31,
+        MAIN_RAM_START
+    };
+
+    if (size > MAIN_RAM_END - MAIN_RAM_START)
+        return 0;
+    for (int i = 0; i < 3; i++) {
+        uint32_t start = candidates[i];
+        if (IN_RANGE_EX(start, MAIN_RAM_START, MAIN_RAM_END - size + 1)
+            && !ranges_overlap(start, size, used, used_size)
+            && !ranges_overlap(start, size, NDS_HEADER->arm9_start, NDS_HEADER->arm9_size + DLDI_AREA_MAX)
+            && !ranges_overlap(start, size, NDS_HEADER->arm7_start, NDS_HEADER->arm7_size))
+            return start;
+    }
+    return 0;
+}
+
+uint32_t loader_free_ram(uint32_t size) {
+    return loader_free_ram_except(size, 0, 0);
+}
+
+/**
+ * @brief Load an ARM7 binary through shared WRAM, for when there is no
+ * room in main RAM to stage it.
+ *
+ * The part of the binary in shared WRAM is read in place at the end, as
+ * shared WRAM is used for staging until then.
+ */
+static void load_staged_wram(FIL *fp, const load_segment_t *segment, uint32_t shared_size) {
+    unsigned int bytes_read;
+    uint8_t mapping = WRAM_ARM9_LOW;
+
+    checkErrorFatFs("Could not read BOOT.NDS", f_lseek(fp, segment->offset + shared_size));
+    ipc_arm7_wait(segment->phase);
+    ipc_wram_map(mapping);
+    for (uint32_t offset = shared_size; offset < segment->size; offset += ARM7_CHUNK_SIZE) {
+        uint32_t size = MIN(ARM7_CHUNK_SIZE, segment->size - offset);
+        checkErrorFatFs("Could not read BOOT.NDS", linkmap_read(fp, (void*) WRAM_STAGING, size, &bytes_read));
+
+        // Once the ARM7 is done with the previous chunk, swap halves:
+        // this hands it the new chunk, and the ARM9 the free half.
+        ipc_arm7_wait(segment->phase);
+        mapping = mapping == WRAM_ARM9_LOW ? WRAM_ARM9_HIGH : WRAM_ARM9_LOW;
+        ipc_wram_map(mapping);
+        ipc_arm7_copy(segment->address + offset, WRAM_STAGING, size);
+    }
+
+    if (shared_size) {
+        ipc_arm7_wait(segment->phase);
+        ipc_wram_map(WRAM_ARM9);
+        checkErrorFatFs("Could not read BOOT.NDS", f_lseek(fp, segment->offset));
+        checkErrorFatFs("Could not read BOOT.NDS", linkmap_read(fp, (void*) segment->address, shared_size, &bytes_read));
+    }
+}
+
+/**
+ * @brief Load a packed binary, unpacking each chunk as soon as it arrives.
+ *
+ * Binaries for ARM7 RAM are unpacked to free main RAM as a whole, and then
+ * copied by the ARM7; all others are unpacked in place.
+ */
+static void load_packed(FIL *fp, const load_segment_t *segment) {
+    unsigned int bytes_read;
+    uint32_t dest = segment->address;
+    uint32_t dest_size = 0;
+
+    // The chunk buffer may overlap the staging area of an ARM7 binary
+    // loaded before, which the ARM7 could still be copying from.
+    ipc_arm7_wait(segment->phase);
+    if (segment->staged) {
+        dest = loader_free_ram(segment->size);
+        dest_size = segment->size;
+    }
+    uint32_t input = loader_free_ram_except(PACKED_CHUNK_SIZE, dest, dest_size);
+    if (!dest || !input) {
+        eprintf("Not enough memory to unpack."); haltOnError();
+    }
+
+    bool patch = IN_RANGE_EX(NDS_HEADER->arm9_start, segment->address, segment->address + segment->size);
+    bool done = false;
+    lz77_state_t lz;
+    lz77_begin(&lz, (void*) dest, segment->size);
+
+    checkErrorFatFs("Could not read BOOT.NDS", f_lseek(fp, segment->offset));
+    for (uint32_t offset = 0; offset < segment->packed && !done; offset += PACKED_CHUNK_SIZE) {
+        uint32_t size = MIN(PACKED_CHUNK_SIZE, segment->packed - offset);
+        const uint8_t *in = (const uint8_t*) input;
+        checkErrorFatFs("Could not read BOOT.NDS", linkmap_read(fp, (void*) input, size, &bytes_read));
+        if (bytes_read != size) break;
+
+        if (!offset) {
+            if (*((const uint32_t*) in) != NDSPACK_LZ77_HEADER(segment->size)) break;
+            in += 4;
+            size -= 4;
+        }
+        done = lz77_unpack(&lz, in, size);
+
+        if (patch) {
+            // Later back-references may still copy from the last LZ77_WINDOW
+            // bytes, so these must keep the original stub until the end.
+            uint8_t *loaded = lz.dest;
+            if (!done)
+                loaded -= MIN((uint32_t) (lz.dest - (uint8_t*) dest), LZ77_WINDOW);
+            timing_phase(segment->phase);
+            dldi_patch_check(dldi_patch_update(loaded));
+            timing_phase(PHASE_DLDI_PATCH);
+        }
+    }
+
+    if (!done) {
+        eprintf("Could not unpack BOOT.NDS."); haltOnError();
+    }
+    if (segment->staged)
+        ipc_arm7_copy(segment->address, dest, segment->size);
+}
+
+static void load_segment(FIL *fp, const load_segment_t *segment) {
+    unsigned int bytes_read;
+
+    if (segment->packed) {
+        load_packed(fp, segment);
+    } else if (segment->staged) {
+        uint32_t shared_size = segment->address < ARM7_PRIVATE_RAM
+            ? MIN(segment->size, ARM7_PRIVATE_RAM - segment->address) : 0;
+        uint32_t private_size = segment->size - shared_size;
+        uint32_t staging = loader_free_ram(private_size);
+
+        if (staging) {
+            // Read the part in shared WRAM in place, and the rest into main
+            // RAM in one go, for the ARM7 to copy in the background.
+            checkErrorFatFs("Could not read BOOT.NDS", f_lseek(fp, segment->offset));
+            ipc_arm7_wait(segment->phase);
+            ipc_wram_map(WRAM_ARM9);
+            if (shared_size)
+                checkErrorFatFs("Could not read BOOT.NDS", linkmap_read(fp, (void*) segment->address, shared_size, &bytes_read));
+            if (private_size) {
+                checkErrorFatFs("Could not read BOOT.NDS", linkmap_read(fp, (void*) staging, private_size, &bytes_read));
+                ipc_arm7_copy(segment->address + shared_size, staging, private_size);
+            }
+        } else {
+            load_staged_wram(fp, segment, shared_size);
+        }
+    } else {
+        checkErrorFatFs("Could not read BOOT.NDS", f_lseek(fp, segment->offset));
+
+        // If this segment contains the ARM9 binary, scan each chunk for the
+        // DLDI stub as soon as it arrives, instead of in a second pass.
+        bool patch = IN_RANGE_EX(NDS_HEADER->arm9_start, segment->address, segment->address + segment->size);
+        uint32_t chunk_size = patch ? ARM9_CHUNK_SIZE : segment->size;
+        for (uint32_t offset = 0; offset < segment->size; offset += chunk_size) {
+            uint32_t size = MIN(chunk_size, segment->size - offset);
+            checkErrorFatFs("Could not read BOOT.NDS", linkmap_read(fp, (void*) (segment->address + offset), size, &bytes_read));
+            if (patch) {
+                timing_phase(segment->phase);
+                dldi_patch_check(dldi_patch_update((void*) (segment->address + offset + size)));
+                timing_phase(PHASE_DLDI_PATCH);
+            }
+        }
+    }
+
+    timing_phase(segment->phase);
+}
+
+void loader_load_binaries(FIL *fp, DLDI_INTERFACE *driver) {
+    load_segment_t segments[2] = {
+        {NDS_HEADER->arm9_offset, NDS_HEADER->arm9_size, packed.arm9_packed_size, NDS_HEADER->arm9_start, false, PHASE_ARM9_LOAD},
+        {NDS_HEADER->arm7_offset, NDS_HEADER->arm7_size, packed.arm7_packed_size, NDS_HEADER->arm7_start, arm7_in_arm7_ram, PHASE_ARM7_LOAD}
+    };
+    int segment_count = load_plan(segments);
+    dldi_patch_begin((void*) NDS_HEADER->arm9_start, NDS_HEADER->arm9_size, driver);
+    for (int i = 0; i < segment_count; i++)
+        load_segment(fp, &segments[i]);
+
+#ifdef BENCHMARK_DLDI_SCAN
+    dldi_scan_benchmark((void*) NDS_HEADER->arm9_start, NDS_HEADER->arm9_size);
+#endif
+}
@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __LOADER_H__
+#define __LOADER_H__
+
+#include "common.h"
+#include "dldi.h"
+#include "ff.h"
+
+/* The loader does not touch any hardware registers; everything it needs
+   from the platform goes through the functions below, ipc.h and timing.h,
+   so that it can also be built for the host (see tools/bootsim). */
+
+// Main RAM which binaries may be loaded to; the handoff areas (header,
+// bootstub, argv, boot metrics, ARM7 job ring) are all above it.
+#define MAIN_RAM_START     0x2000000
+#define MAIN_RAM_END       0x23BFE00
+
+// The largest DLDI driver area (32 KB) which can be patched into a stub.
+#define DLDI_AREA_MAX      0x8000
+
+// Scratch space at the bottom of main RAM, used before anything has been
+// loaded: for prefetching the FAT, and for the warm boot checks.
+#define SCRATCH_START      MAIN_RAM_START
+#define SCRATCH_SIZE       0x8000
+
+/**
+ * @brief Print a FatFs error and halt, if result is not FR_OK.
+ */
+void checkErrorFatFs(const char *msg, int result);
+
+/**
+ * @brief Halt, after an error message has been printed.
+ */
+__attribute__((noreturn)) void haltOnError(void);
+
+/**
+ * @brief Prepare an opened BOOT.NDS for loading.
+ */
+void loader_open(FIL *fp);
+
+/**
+ * @brief Read the .nds file header to NDS_HEADER and validate it.
+ */
+void loader_read_header(FIL *fp);
+
+/**
+ * @brief Find free main RAM, once NDS_HEADER has been read.
+ *
+ * The candidates are the top and the bottom of main RAM. The region must
+ * not overlap either binary, nor the handoff areas above MAIN_RAM_END; as
+ * the DLDI driver can be patched in past the end of the ARM9 binary, the
+ * DLDI_AREA_MAX bytes after it are kept free as well.
+ *
+ * @return uint32_t The start of the region, or 0 if there is none.
+ */
+uint32_t loader_free_ram(uint32_t size);
+
+/**
+ * @brief Like loader_free_ram(), but also keeps clear of a region in use;
+ * right below it is tried as well.
+ */
+uint32_t loader_free_ram_except(uint32_t size, uint32_t used, uint32_t used_size);
+
+/**
+ * @brief Load the ARM9 and ARM7 binaries described by NDS_HEADER, and patch
+ * the DLDI driver into the ARM9 binary, if it has a stub.
+ *
+ * The last ARM7 copy may still be in flight on return; see ipc_arm7_wait().
+ * Shared WRAM has to be mapped back to the ARM7 after that.
+ */
+void loader_load_binaries(FIL *fp, DLDI_INTERFACE *driver);
+
+#endif /* __LOADER_H__ */
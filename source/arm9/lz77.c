@@ -0,0 +1,56 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#include "lz77.h"
+
+// The flag byte of the current block is kept in the top 8 bits of flags,
+// followed by a marker bit, and shifted left after each token; once only
+// the marker is left, the next byte is a new flag byte.
+#define FLAGS_EMPTY 0x80000000
+
+void lz77_begin(lz77_state_t *s, void *dest, uint32_t size) {
+    s->dest = dest;
+    s->end = s->dest + size;
+    s->flags = FLAGS_EMPTY;
+    s->pending = -1;
+}
+
+bool lz77_unpack(lz77_state_t *s, const uint8_t *in, uint32_t size) {
+    const uint8_t *in_end = in + size;
+    uint8_t *dest = s->dest;
+    uint8_t *end = s->end;
+    uint32_t flags = s->flags;
+    int32_t pending = s->pending;
+
+    while (dest < end) {
+        if (pending < 0) {
+            if (in == in_end) break;
+            if (flags == FLAGS_EMPTY) {
+                flags = (*in++ << 24) | (1 << 23);
+                continue;
+            }
+            if (!(flags & 0x80000000)) {
+                // Literal byte.
+                *dest++ = *in++;
+                flags <<= 1;
+                continue;
+            }
+            pending = *in++;
+        }
+
+        // Back-reference: 4 bits of length - 3, 12 bits of distance - 1.
+        if (in == in_end) break;
+        uint32_t length = MIN((uint32_t) (pending >> 4) + 3, (uint32_t) (end - dest));
+        const uint8_t *src = dest - ((((pending & 0xF) << 8) | *in++) + 1);
+        pending = -1;
+        flags <<= 1;
+        while (length--)
+            *dest++ = *src++;
+    }
+
+    s->dest = dest;
+    s->flags = flags;
+    s->pending = pending;
+    return dest >= end;
+}
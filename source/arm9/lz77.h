@@ -0,0 +1,39 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __LZ77_H__
+#define __LZ77_H__
+
+#include "common.h"
+
+/* Streaming unpacker for BIOS-compatible LZ77 (type 0x10) data. The packed
+   stream can be fed in pieces of any size, as it arrives; back-references
+   are resolved against the output, so only the output has to be kept. */
+
+#define LZ77_WINDOW 4096 // How far back a back-reference can reach
+
+typedef struct {
+    uint8_t *dest;    // Next byte to write
+    uint8_t *end;     // End of the output
+    uint32_t flags;   // Flags of the current block, see lz77.c
+    int32_t pending;  // First byte of a back-reference split across pieces, or -1
+} lz77_state_t;
+
+/**
+ * @brief Start unpacking a stream.
+ *
+ * @param dest The output buffer.
+ * @param size The unpacked size, from the 4-byte stream header. The stream
+ * header itself is not passed to lz77_unpack().
+ */
+void lz77_begin(lz77_state_t *s, void *dest, uint32_t size);
+
+/**
+ * @brief Unpack the next piece of a stream.
+ *
+ * @return bool true once the whole output has been written.
+ */
+bool lz77_unpack(lz77_state_t *s, const uint8_t *in, uint32_t size);
+
+#endif /* __LZ77_H__ */
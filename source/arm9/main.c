@@ -5,10 +5,17 @@
 #include "common.h"
 #include "bios.h"
 #include "dka.h"
+#include "boot_metrics.h"
 #include "bootstub.h"
-#include "dldi_patch.h"
+#include "cache.h"
 #include "ff.h"
+#include "diskio_stats.h"
 #include "console.h"
+#include "ipc.h"
+#include "loader.h"
+#include "relaunch.h"
+#include "timing.h"
+#include "warmboot.h"
 
 // #define DEBUG
 
@@ -37,29 +44,34 @@ void checkErrorFatFs(const char *msg, int result) {
         eprintf("FatFs error %d.", result);
     }
 
+    haltOnError();
+}
+
+void haltOnError(void) {
     while(1);
 }
 
 /* === Main logic === */
 
-#define IPC_ARM7_NONE  0x000
-#define IPC_ARM7_COPY  0x100
-#define IPC_ARM7_RESET 0x200
-#define IPC_ARM7_SYNC  0xF00
+const char *executable_path = "/BOOT.NDS";
 
-void ipc_arm7_cmd(uint32_t cmd) {
-    uint32_t next_sync = REG_IPCSYNC & 0xF;
-    uint32_t last_sync = next_sync;
-    REG_IPCSYNC = cmd;
-    while (last_sync == next_sync) next_sync = REG_IPCSYNC & 0xF;
+_Static_assert(PHASE_COUNT == BOOT_METRICS_PHASES, "boot phase list mismatch");
+
+static void write_boot_metrics(void) {
+    BOOT_METRICS->magic = 0;
+    BOOT_METRICS->version = BOOT_METRICS_VERSION;
+    BOOT_METRICS->size = sizeof(boot_metrics_t);
+    for (int i = 0; i < PHASE_COUNT; i++)
+        BOOT_METRICS->phase_us[i] = timing_ticks_to_us(phase_ticks[i]);
+    BOOT_METRICS->sectors_read = disk_stats.sectors;
+    BOOT_METRICS->dldi_commands = disk_stats.commands;
+    BOOT_METRICS->arm7_bytes_copied = arm7_bytes_copied;
+    __aeabi_memcpy(BOOT_METRICS->dldi_name, _io_dldi_stub.friendlyName, sizeof(BOOT_METRICS->dldi_name));
+    BOOT_METRICS->magic = BOOT_METRICS_MAGIC;
 }
 
-const char *executable_path = "/BOOT.NDS";
-
 int main(void) {
     FIL fp;
-    unsigned int bytes_read;
-    int result;
 
     // Initialize VRAM (128KB to main engine, rest to CPU, 32KB WRAM to ARM7).
     REG_VRAMCNT_ABCD = VRAMCNT_ABCD(0x81, 0x80, 0x82, 0x8A);
@@ -83,26 +95,56 @@ int main(void) {
 #endif
 #endif
 
-    dprintf("ARM7 sync");
-    for (int i = 1; i <= 16; i++) {
-        dprintf(".");
-        ipc_arm7_cmd((i << 8) & 0xF00);
+    // Initialize the console before timing starts, so that it is not
+    // counted towards the first phase.
+    if (debugEnabled) consoleInit();
+    timing_start();
+
+    ipc_irq_init();
+    dprintf("ARM7 sync... ");
+    int sync_step = ipc_arm7_sync();
+    if (sync_step) {
+        eprintf("ARM7 not responding.\nSync step %d, IPCSYNC %X.", sync_step, REG_IPCSYNC);
+        haltOnError();
     }
-    dprintf(" OK\n");
+    dprintf("OK\n");
+    timing_phase(PHASE_ARM7_SYNC);
 
 #ifndef _NO_BOOTSTUB
     // Create a bootstub in memory, if one doesn't already exist.
     if (DKA_BOOTSTUB->magic != DKA_BOOTSTUB_MAGIC) {
+        // The packed ARM9 binary comes last, as its size is only known
+        // once the ARM7 has packed it. Both binaries are word-aligned, as
+        // the ARM7 copies and packs them, and the bootstub unpacks them,
+        // a word at a time.
         uint8_t *bootstub_loc = ((uint8_t*) DKA_BOOTSTUB) + sizeof(dka_bootstub_t);
-        uint8_t *arm9_bin_loc = bootstub_loc + bootstub_size;
-        uint8_t *arm7_bin_loc = arm9_bin_loc + NDS_HEADER->arm9_size;
-        
-        bootstub.arm9_target_entry = arm9_bin_loc;
+        warmboot_t *warmboot_loc = (warmboot_t*) (((uint32_t) bootstub_loc + bootstub_size + 3) & ~3);
+        uint32_t records_end = (uint32_t) (warmboot_loc + 1);
+#ifdef RELAUNCH_CACHE
+        records_end += sizeof(relaunch_entry_t);
+#endif
+        uint8_t *arm7_bin_loc = (uint8_t*) records_end;
+        uint8_t *arm9_pack_loc = (uint8_t*) (((uint32_t) arm7_bin_loc + NDS_HEADER->arm7_size + 3) & ~3);
+
+        bootstub.arm9_target_entry = bootstub_loc + (&bootstub_arm9_unpack - (char*) &bootstub);
         bootstub.arm7_target_entry = arm7_bin_loc;
+        bootstub.warmboot = warmboot_loc;
+        bootstub.arm9_packed = arm9_pack_loc;
+        bootstub.arm9_start = (void*) NDS_HEADER->arm9_start;
+        bootstub.arm9_restart = (void*) NDS_HEADER->arm9_entry;
+        warmboot_loc->magic = 0;
+#ifdef RELAUNCH_CACHE
+        ((relaunch_entry_t*) (warmboot_loc + 1))->magic = 0;
+#endif
 
+        // The bootstub itself is in ITCM, out of reach of the ARM7. The
+        // binaries are copied by the ARM7, while the filesystem is mounted;
+        // the ARM9 binary is packed on the way, which mostly drops the
+        // unused part of the DLDI area. It is unpacked by the bootstub.
         __aeabi_memcpy(bootstub_loc, &bootstub, bootstub_size);
-        __aeabi_memcpy(arm9_bin_loc, (void*) NDS_HEADER->arm9_start, NDS_HEADER->arm9_size);
-        __aeabi_memcpy(arm7_bin_loc, (void*) NDS_HEADER->arm7_start, NDS_HEADER->arm7_size);
+        ipc_arm7_queue(IPC_JOB_COPY, (uint32_t) arm7_bin_loc, NDS_HEADER->arm7_start, NDS_HEADER->arm7_size);
+        ipc_arm7_queue(IPC_JOB_PACK, (uint32_t) arm9_pack_loc, NDS_HEADER->arm9_start, (NDS_HEADER->arm9_size + 3) & ~3);
+        ipc_arm7_submit();
 
         DKA_BOOTSTUB->magic = DKA_BOOTSTUB_MAGIC;
         DKA_BOOTSTUB->arm9_entry = bootstub_loc;
@@ -110,76 +152,58 @@ int main(void) {
         DKA_BOOTSTUB->loader_size = 0;
     }
 #endif // _NO_BOOTSTUB
+    timing_phase(PHASE_BOOTSTUB);
 
     // Create a copy of the DLDI driver in VRAM before initializing it.
     // We'll make use of this copy for patching the ARM9 binary later.
     __aeabi_memcpy4(DLDI_BACKUP, &_io_dldi_stub, 16384);
+    timing_phase(PHASE_DLDI_BACKUP);
 
-    // Mount the filesystem. Try to open BOOT.NDS.
-    dprintf("Mounting FAT filesystem... ");
-    checkErrorFatFs("Could not mount FAT filesystem", f_mount(&fs, "", 1));
-    dprintf("OK\n");
-    checkErrorFatFs("Could not find BOOT.NDS", f_open(&fp, executable_path, FA_READ));
-    dprintf("BOOT.NDS found.\n");
-
-    // Read the .nds file header.
-    checkErrorFatFs("Could not read BOOT.NDS", f_read(&fp, NDS_HEADER, sizeof(nds_header_t), &bytes_read));
-
-    bool waiting_arm7 = false;
-    // Load the ARM7 binary.
+#ifndef _NO_BOOTSTUB
+    // When returning through the bootstub, reuse the previous boot's
+    // filesystem state, if the card has not changed since.
+    if (warmboot_restore(&fs, &fp)) {
+        dprintf("Warm boot.\n");
+        timing_phase(PHASE_MOUNT);
+    } else
+#endif
     {
-        dprintf("ARM7: %d bytes @ %X\n", NDS_HEADER->arm7_size, NDS_HEADER->arm7_start);
-        bool in_main_ram = IN_RANGE_EX(NDS_HEADER->arm7_start, 0x2000000, 0x23BFE00);
-        bool in_arm7_ram = IN_RANGE_EX(NDS_HEADER->arm7_start, 0x37F8000, 0x380FE00);
-        if (!NDS_HEADER->arm7_size
-            || !IN_RANGE_EX(NDS_HEADER->arm7_entry - NDS_HEADER->arm7_start, 0, NDS_HEADER->arm7_size)
-            || (!in_main_ram && !in_arm7_ram)
-            || (in_main_ram && !IN_RANGE_EX(NDS_HEADER->arm7_start + NDS_HEADER->arm7_size, 0x2000001, 0x23BFE01))
-            || (in_arm7_ram && !IN_RANGE_EX(NDS_HEADER->arm7_start + NDS_HEADER->arm7_size, 0x37F8001, 0x380FE01))) {
-            eprintf("Invalid ARM7 binary location."); while(1);
-        }
-
-        checkErrorFatFs("Could not read BOOT.NDS", f_lseek(&fp, NDS_HEADER->arm7_offset));
-        checkErrorFatFs("Could not read BOOT.NDS", f_read(&fp, (void*) (in_arm7_ram ? 0x2000000 : NDS_HEADER->arm7_start), NDS_HEADER->arm7_size, &bytes_read));
-
-        // If the ARM7 binary has to be relocated to ARM7 RAM, the ARM7 CPU
-        // has to relocate it from main memory.
-        if (in_arm7_ram) {
-            REG_IPCFIFOSEND = NDS_HEADER->arm7_size;
-            REG_IPCFIFOSEND = 0x2000000;
-            REG_IPCFIFOSEND = NDS_HEADER->arm7_start;
-            ipc_arm7_cmd(IPC_ARM7_COPY);
-            waiting_arm7 = true;
-        }
-    }
+        // Mount the filesystem. Try to open BOOT.NDS.
+        dprintf("Mounting FAT filesystem... ");
+        checkErrorFatFs("Could not mount FAT filesystem", f_mount(&fs, "", 1));
+        dprintf("OK\n");
+        timing_phase(PHASE_MOUNT);
+
+        // The bootstub copies read miniboot's own binaries and header, which
+        // loading BOOT.NDS is about to overwrite.
+        ipc_arm7_wait(PHASE_MOUNT);
+
+        checkErrorFatFs("Could not find BOOT.NDS", f_open(&fp, executable_path, FA_READ));
+        dprintf("BOOT.NDS found.\n");
+#ifndef _NO_BOOTSTUB
+        LBA_t dir_sect = fs.winsect;
+#endif
 
-    // Load the ARM9 binary.
+        loader_open(&fp);
+#ifndef _NO_BOOTSTUB
+        warmboot_save(&fs, &fp, dir_sect);
+#endif
+    }
+    timing_phase(PHASE_OPEN);
+
+#ifdef RELAUNCH_CACHE
+    bool relaunched = relaunch_restore();
+    if (relaunched) {
+        dprintf("Relaunching from RAM.\n");
+        timing_phase(PHASE_ARM9_LOAD);
+    } else
+#endif
     {
-        dprintf("ARM9: %d bytes @ %X\n", NDS_HEADER->arm9_size, NDS_HEADER->arm9_start);
-        bool in_main_ram = IN_RANGE_EX(NDS_HEADER->arm9_start, 0x2000000, 0x23BFE00);
-        if (!NDS_HEADER->arm9_size
-            || !IN_RANGE_EX(NDS_HEADER->arm9_entry - NDS_HEADER->arm9_start, 0, NDS_HEADER->arm9_size)
-            || !in_main_ram
-            || !IN_RANGE_EX(NDS_HEADER->arm9_start + NDS_HEADER->arm9_size, 0x2000001, 0x23BFE01)) {
-            eprintf("Invalid ARM9 binary location."); while(1);
-        }
-
-        checkErrorFatFs("Could not read BOOT.NDS", f_lseek(&fp, NDS_HEADER->arm9_offset));
-        if (waiting_arm7) {
-            ipc_arm7_cmd(IPC_ARM7_NONE);
-            waiting_arm7 = false;
-        }
-        checkErrorFatFs("Could not read BOOT.NDS", f_read(&fp, (void*) NDS_HEADER->arm9_start, NDS_HEADER->arm9_size, &bytes_read));
-
-        // Try to apply the DLDI driver patch.
-        result = dldi_patch_relocate((void*) NDS_HEADER->arm9_start, NDS_HEADER->arm9_size, DLDI_BACKUP);
-        if (result) {
-            eprintf("Failed to apply DLDI patch.\n");
-            switch (result) {
-                case DLPR_NOT_ENOUGH_SPACE: eprintf("Not enough space."); break;
-            }
-            while(1);
-        }
+        loader_read_header(&fp);
+        timing_phase(PHASE_HEADER);
+
+        // Load the ARM7 and ARM9 binaries, applying the DLDI driver patch.
+        loader_load_binaries(&fp, DLDI_BACKUP);
     }
 
     // Set up argv.
@@ -188,6 +212,32 @@ int main(void) {
     __aeabi_memcpy(DKA_ARGV->cmdline, executable_path, DKA_ARGV->cmdline_size);
     DKA_ARGV->magic = DKA_ARGV_MAGIC;
 
+    // Wait for the last ARM7 chunk, if still in flight, then give all of
+    // shared WRAM back to the ARM7.
+    ipc_arm7_wait(PHASE_HANDOFF);
+    ipc_wram_map(WRAM_ARM7);
+#ifdef RELAUNCH_CACHE
+    if (!relaunched) relaunch_save();
+#endif
+    timing_phase(PHASE_HANDOFF);
+    write_boot_metrics();
+
+    dprintf("DLDI: %d sectors, %d commands\n", disk_stats.sectors, disk_stats.commands);
+#if FF_WF_MARK_WINDOW_READS
+    dprintf("Sector cache: %d hits, %d misses\n", disk_stats.cache_hits, disk_stats.cache_misses);
+#endif
+    if (debugEnabled) {
+        timing_print();
+        timing_print_throughput(PHASE_ARM7_LOAD, NDS_HEADER->arm7_size);
+        timing_print_throughput(PHASE_ARM9_LOAD, NDS_HEADER->arm9_size);
+        if (arm7_bytes_copied)
+            eprintf("ARM7 copy: %u bytes in %u us\n", arm7_bytes_copied, timing_ticks_to_us(IPC_JOB_RING->copy_ticks));
+        eprintf("ARM7 IPC: first reply %u us\n", timing_ticks_to_us(ipc_latency.sync_ticks));
+        if (ipc_latency.count)
+            eprintf("ARM7 IPC: %u round trips, avg %u us, max %u us\n", ipc_latency.count,
+                timing_ticks_to_us(ipc_latency.total / ipc_latency.count), timing_ticks_to_us(ipc_latency.max));
+    }
+
     dprintf("Launching");
 
     // If debug enabled, wait for user to stop holding START
@@ -197,8 +247,13 @@ int main(void) {
     displayReset();
     REG_EXMEMCNT = 0xE880;
 
+    // Write everything back to main RAM before either binary starts.
+    cache_disable();
+
     // Start the ARM7 binary.
     ipc_arm7_cmd(IPC_ARM7_RESET);
+    ipc_irq_exit();
+    timing_stop();
 
     // Start the ARM9 binary.
     swiSoftReset();
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#include "aeabi.h"
+#include "boot_metrics.h"
+#include "bootstub.h"
+#include "dka.h"
+#include "ipc.h"
+#include "loader.h"
+#include "relaunch.h"
+#include "warmboot.h"
+
+#ifdef RELAUNCH_CACHE
+
+// The parts of the copy are aligned to cache lines, so that the ARM9's
+// writes to one never spill over the ARM7's writes to another.
+#define ALIGN32(x)   (((x) + 31) & ~31)
+#define HEADER_SIZE  ALIGN32(sizeof(nds_header_t))
+
+static relaunch_entry_t *relaunch_entry(void) {
+    warmboot_t *rec = warmboot_record();
+    if (!rec || rec->magic != WARMBOOT_MAGIC)
+        return NULL;
+    relaunch_entry_t *entry = (relaunch_entry_t*) (rec + 1);
+    return (uint32_t) (entry + 1) <= (uint32_t) BOOT_METRICS ? entry : NULL;
+}
+
+// The end of the main RAM which the next boot writes to before it gets to
+// relaunch_restore(): the scratch space, and miniboot's own ARM9 binary,
+// which the bootstub unpacks to where it was first loaded. Only called
+// once warmboot_record() has checked the bootstub.
+static uint32_t boot_ram_end(void) {
+    const bootstub_header_t *stub = (const bootstub_header_t*) DKA_BOOTSTUB->arm9_entry;
+    uint32_t packed = (uint32_t) stub->arm9_packed;
+    uint32_t end = SCRATCH_START + SCRATCH_SIZE;
+    if (!(packed & 3) && IN_RANGE_EX(packed, (uint32_t) DKA_BOOTSTUB, (uint32_t) BOOT_METRICS))
+        end = MAX(end, (uint32_t) stub->arm9_start + *((const uint32_t*) packed));
+    return end;
+}
+
+static uint32_t arm7_offset(uint32_t arm9_size) {
+    return HEADER_SIZE + ALIGN32(arm9_size);
+}
+
+// A rotate-and-add checksum over the entry and the copy; cheap enough to
+// run over the whole copy on every relaunch.
+static uint32_t relaunch_checksum(const relaunch_entry_t *entry, uint32_t size) {
+    uint32_t sum = 0;
+    for (const uint32_t *p = &entry->size; p < &entry->checksum; p++)
+        sum = ((sum << 1) | (sum >> 31)) + *p;
+    for (const uint32_t *p = (const uint32_t*) entry->data; p < (const uint32_t*) (entry->data + size); p++)
+        sum = ((sum << 1) | (sum >> 31)) + *p;
+    return sum;
+}
+
+bool relaunch_restore(void) {
+    relaunch_entry_t *entry = relaunch_entry();
+    if (!entry || entry->magic != RELAUNCH_MAGIC)
+        return false;
+
+    // Only use the copy for the same BOOT.NDS; the warm boot record is
+    // up to date with the file just opened.
+    const warmboot_t *rec = warmboot_record();
+    if (entry->size != rec->fp.obj.objsize || entry->sclust != rec->fp.obj.sclust || entry->mtime != rec->mtime)
+        return false;
+
+    // Check that the copy is still intact.
+    if (!IN_RANGE_EX(entry->data, MAIN_RAM_START, MAIN_RAM_END - HEADER_SIZE)
+        || entry->arm9_size > MAIN_RAM_END - MAIN_RAM_START)
+        return false;
+    const nds_header_t *header = (const nds_header_t*) entry->data;
+    uint32_t offset = arm7_offset(entry->arm9_size);
+    if (header->arm7_size > MAIN_RAM_END - MAIN_RAM_START
+        || offset + header->arm7_size > MAIN_RAM_END - entry->data
+        || relaunch_checksum(entry, offset + header->arm7_size) != entry->checksum) {
+        entry->magic = 0;
+        return false;
+    }
+
+    __aeabi_memcpy4(NDS_HEADER, header, sizeof(nds_header_t));
+    ipc_arm7_copy(NDS_HEADER->arm7_start, entry->data + offset, NDS_HEADER->arm7_size);
+    __aeabi_memcpy((void*) NDS_HEADER->arm9_start, (const void*) (entry->data + HEADER_SIZE), entry->arm9_size);
+    return true;
+}
+
+void relaunch_save(void) {
+    relaunch_entry_t *entry = relaunch_entry();
+    if (!entry) return;
+    entry->magic = 0;
+
+    uint32_t arm9_size = MIN(NDS_HEADER->arm9_size + DLDI_AREA_MAX, MAIN_RAM_END - NDS_HEADER->arm9_start);
+    uint32_t offset = arm7_offset(arm9_size);
+    uint32_t size = offset + NDS_HEADER->arm7_size;
+    uint32_t data = loader_free_ram_except(ALIGN32(size), MAIN_RAM_START, boot_ram_end() - MAIN_RAM_START);
+    if (!data) return;
+
+    // The ARM7 binary may be in ARM7 RAM, so the ARM7 copies it out.
+    ipc_arm7_copy(data + offset, NDS_HEADER->arm7_start, NDS_HEADER->arm7_size);
+    __aeabi_memcpy4((void*) data, NDS_HEADER, sizeof(nds_header_t));
+    __aeabi_memcpy((void*) (data + HEADER_SIZE), (const void*) NDS_HEADER->arm9_start, arm9_size);
+    ipc_arm7_wait(PHASE_HANDOFF);
+
+    const warmboot_t *rec = warmboot_record();
+    entry->size = rec->fp.obj.objsize;
+    entry->sclust = rec->fp.obj.sclust;
+    entry->mtime = rec->mtime;
+    entry->data = data;
+    entry->arm9_size = arm9_size;
+    entry->checksum = relaunch_checksum(entry, size);
+    entry->magic = RELAUNCH_MAGIC;
+}
+
+#endif
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __RELAUNCH_H__
+#define __RELAUNCH_H__
+
+#include "common.h"
+
+/* === Relaunch cache ===
+ *
+ * Keep a copy of BOOT.NDS's header and binaries, as loaded and patched, in
+ * main RAM they do not use, so that returning to BOOT.NDS through the
+ * bootstub does not have to read them from the card again. The launched
+ * program is free to overwrite the copy: it is only used if its checksum
+ * still matches, and if the file size, start cluster and last write time
+ * of BOOT.NDS match the warm boot record. The entry describing the copy
+ * follows the warm boot record.
+ */
+
+// #define RELAUNCH_CACHE
+
+#ifdef _NO_BOOTSTUB
+#undef RELAUNCH_CACHE
+#endif
+
+#define RELAUNCH_MAGIC 0x4C524D4D // "MMRL" in ASCII
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;      // BOOT.NDS file size
+    uint32_t sclust;    // BOOT.NDS start cluster
+    uint32_t mtime;     // BOOT.NDS last write, as in warmboot_t
+    uint32_t data;      // The copy: header, ARM9 region, ARM7 binary
+    uint32_t arm9_size; // Size of the ARM9 region, including the DLDI driver area
+    uint32_t checksum;  // Checksum of the fields above and the copy
+} relaunch_entry_t;
+
+/**
+ * @brief Restore NDS_HEADER and both binaries from the relaunch cache.
+ *
+ * Must be called once BOOT.NDS has been opened, and the warm boot record
+ * written or restored. The ARM7 binary is still being copied on return;
+ * see ipc_arm7_wait().
+ *
+ * @return true if BOOT.NDS was restored from the cache.
+ */
+bool relaunch_restore(void);
+
+/**
+ * @brief Copy NDS_HEADER and both binaries to the relaunch cache, after
+ * they have been loaded from the card.
+ *
+ * Must be called with shared WRAM mapped to the ARM7.
+ */
+void relaunch_save(void);
+
+#endif /* __RELAUNCH_H__ */
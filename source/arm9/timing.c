@@ -0,0 +1,67 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+/* Boot phase timing, using cascaded hardware timers. */
+
+#include "console.h"
+#include "timing.h"
+
+uint32_t phase_ticks[PHASE_COUNT];
+static uint32_t phase_mark;
+
+static const char *const phase_names[PHASE_COUNT] = {
+    "ARM7 sync",
+    "Bootstub",
+    "DLDI backup",
+    "Mount",
+    "Open",
+    "Header",
+    "ARM7 load",
+    "ARM7 wait",
+    "ARM9 load",
+    "DLDI patch",
+    "Handoff"
+};
+
+void timing_start(void) {
+    REG_TMCNT(0) = 0;
+    REG_TMCNT(1) = 0;
+    REG_TMCNT_H(1) = TIMER_ENABLE | TIMER_CASCADE;
+    REG_TMCNT_H(0) = TIMER_ENABLE | TIMER_DIV_64;
+    phase_mark = 0;
+}
+
+void timing_stop(void) {
+    REG_TMCNT(0) = 0;
+    REG_TMCNT(1) = 0;
+}
+
+uint32_t timing_ticks(void) {
+    uint32_t hi, lo;
+    // Re-read if the low half overflowed in between.
+    do {
+        hi = REG_TMCNT_L(1);
+        lo = REG_TMCNT_L(0);
+    } while (hi != REG_TMCNT_L(1));
+    return (hi << 16) | lo;
+}
+
+void timing_phase(boot_phase_t phase) {
+    uint32_t now = timing_ticks();
+    phase_ticks[phase] += now - phase_mark;
+    phase_mark = now;
+}
+
+void timing_print(void) {
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (phase_ticks[i])
+            eprintf("%s: %u us\n", phase_names[i], timing_ticks_to_us(phase_ticks[i]));
+    }
+}
+
+void timing_print_throughput(boot_phase_t phase, uint32_t bytes) {
+    uint32_t us = timing_ticks_to_us(phase_ticks[phase]);
+    // Binaries are at most 3.75 MB, so this cannot overflow.
+    if (us) eprintf("%s: %u KB/s\n", phase_names[phase], (bytes >> 10) * 1000000 / us);
+}
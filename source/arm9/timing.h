@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+#include "common.h"
+
+typedef enum {
+    PHASE_ARM7_SYNC,
+    PHASE_BOOTSTUB,
+    PHASE_DLDI_BACKUP,
+    PHASE_MOUNT,
+    PHASE_OPEN,
+    PHASE_HEADER,
+    PHASE_ARM7_LOAD,
+    PHASE_ARM7_WAIT,
+    PHASE_ARM9_LOAD,
+    PHASE_DLDI_PATCH,
+    PHASE_HANDOFF,
+    PHASE_COUNT
+} boot_phase_t;
+
+/**
+ * Time spent in each boot phase, in timer ticks.
+ */
+extern uint32_t phase_ticks[PHASE_COUNT];
+
+/**
+ * Start timers 0 and 1 as a cascaded 32-bit counter running at ~524 kHz.
+ */
+void timing_start(void);
+
+/**
+ * Stop timers 0 and 1, so that the launched program finds them idle.
+ */
+void timing_stop(void);
+
+/**
+ * @brief Read the current timer value, in ticks.
+ */
+uint32_t timing_ticks(void);
+
+/**
+ * @brief Attribute the time elapsed since the previous call to a phase.
+ */
+void timing_phase(boot_phase_t phase);
+
+/**
+ * @brief Convert timer ticks to microseconds.
+ */
+static inline uint32_t timing_ticks_to_us(uint32_t ticks) {
+    // 64 / 33.513982 MHz ~= 489 / 256 us
+    return ((uint64_t) ticks * 489) >> 8;
+}
+
+/**
+ * @brief Print the per-phase breakdown to the console.
+ */
+void timing_print(void);
+
+/**
+ * @brief Print the throughput of a load phase to the console.
+ */
+void timing_print_throughput(boot_phase_t phase, uint32_t bytes);
+
+#endif /* __TIMING_H__ */
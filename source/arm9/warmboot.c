@@ -0,0 +1,127 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#include "aeabi.h"
+#include "bios.h"
+#include "bootstub.h"
+#include "boot_metrics.h"
+#include "dka.h"
+#include "ff.h"
+#include "diskio.h"
+#include "loader.h"
+#include "warmboot.h"
+
+#ifndef _NO_BOOTSTUB
+
+// Sector buffer for validation; nothing has been loaded yet.
+#define WARMBOOT_SCRATCH ((void*) SCRATCH_START)
+
+#define RECORD_CRC_START offsetof(warmboot_t, vbr_crc)
+
+warmboot_t *warmboot_record(void) {
+    if (DKA_BOOTSTUB->magic != DKA_BOOTSTUB_MAGIC)
+        return NULL;
+
+    // Another program may have installed its own bootstub since, so check
+    // that it is miniboot's, and the pointers, before following them.
+    uint32_t header = (uint32_t) DKA_BOOTSTUB->arm9_entry;
+    if ((header & 3) || !IN_RANGE_EX(header, (uint32_t) DKA_BOOTSTUB, (uint32_t) BOOT_METRICS - sizeof(bootstub_header_t)))
+        return NULL;
+    if (((bootstub_header_t*) header)->magic != BOOTSTUB_MAGIC)
+        return NULL;
+    uint32_t record = (uint32_t) ((bootstub_header_t*) header)->warmboot;
+    if ((record & 3) || !IN_RANGE_EX(record, (uint32_t) DKA_BOOTSTUB, (uint32_t) BOOT_METRICS - sizeof(warmboot_t)))
+        return NULL;
+    return (warmboot_t*) record;
+}
+
+static uint16_t record_crc(const warmboot_t *rec) {
+    return swiCRC16(0xFFFF, ((const uint8_t*) rec) + RECORD_CRC_START, sizeof(warmboot_t) - RECORD_CRC_START);
+}
+
+// Reads the sector to WARMBOOT_SCRATCH.
+static bool sector_crc(BYTE pdrv, LBA_t sector, uint16_t *crc) {
+    if (disk_read(pdrv, WARMBOOT_SCRATCH, sector, 1) != RES_OK)
+        return false;
+    *crc = swiCRC16(0xFFFF, WARMBOOT_SCRATCH, FF_MAX_SS);
+    return true;
+}
+
+// Find the last write time of a file in a directory sector, by its start
+// cluster and size.
+static bool entry_mtime(const uint8_t *sector, const FIL *fp, uint32_t *mtime) {
+    for (const uint8_t *dir = sector; dir < sector + FF_MAX_SS; dir += 32) {
+        if (dir[0] == 0x00 || dir[0] == 0xE5 || (dir[11] & 0x18))
+            continue;
+        uint32_t sclust = (dir[21] << 24) | (dir[20] << 16) | (dir[27] << 8) | dir[26];
+        uint32_t size = (dir[31] << 24) | (dir[30] << 16) | (dir[29] << 8) | dir[28];
+        if (sclust == fp->obj.sclust && size == fp->obj.objsize) {
+            *mtime = (dir[25] << 24) | (dir[24] << 16) | (dir[23] << 8) | dir[22];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool warmboot_restore(FATFS *fs, FIL *fp) {
+    warmboot_t *rec = warmboot_record();
+    if (!rec || rec->magic != WARMBOOT_MAGIC || rec->crc != record_crc(rec))
+        return false;
+
+    // The storage device has to be initialized again either way; if the
+    // record turns out to be stale, f_mount() will repeat this.
+    const FATFS *saved = (const FATFS*) rec->fs;
+    if (disk_initialize(saved->pdrv))
+        return false;
+
+    uint16_t vbr_crc, dir_crc;
+    if (!sector_crc(saved->pdrv, saved->volbase, &vbr_crc) || vbr_crc != rec->vbr_crc
+        || !sector_crc(saved->pdrv, rec->dir_sect, &dir_crc) || dir_crc != rec->dir_crc) {
+        rec->magic = 0;
+        return false;
+    }
+
+    // Register the volume without accessing it, then restore its state.
+    f_mount(fs, "", 0);
+    __aeabi_memcpy4(fs, rec->fs, offsetof(FATFS, win));
+    fs->winsect = (LBA_t) 0 - 1; // Nothing has been read to the window.
+
+    __aeabi_memcpy4(fp, &rec->fp, sizeof(FIL));
+    if (fp->cltbl)
+        __aeabi_memcpy4(fp->cltbl, rec->linkmap, rec->linkmap[0] * sizeof(DWORD));
+    return true;
+}
+
+void warmboot_save(const FATFS *fs, const FIL *fp, LBA_t dir_sect) {
+    warmboot_t *rec = warmboot_record();
+    if (!rec) return;
+    rec->magic = 0;
+
+    // Files too fragmented for the record are left to a full boot.
+    uint32_t linkmap_size = fp->cltbl ? fp->cltbl[0] : 0;
+    if (linkmap_size > WARMBOOT_LINKMAP_SIZE)
+        return;
+
+#if FF_WF_MARK_WINDOW_READS
+    // Both sectors were just read through the FatFs window, so mark these
+    // reads as window reads; they are then normally served by the cache.
+    BYTE pdrv = fs->pdrv | 0x80;
+#else
+    BYTE pdrv = fs->pdrv;
+#endif
+    if (!sector_crc(pdrv, fs->volbase, &rec->vbr_crc) || !sector_crc(pdrv, dir_sect, &rec->dir_crc)
+        || !entry_mtime(WARMBOOT_SCRATCH, fp, &rec->mtime))
+        return;
+
+    rec->dir_sect = dir_sect;
+    __aeabi_memcpy4(rec->fs, fs, offsetof(FATFS, win));
+    __aeabi_memcpy4(&rec->fp, fp, sizeof(FIL));
+    __aeabi_memset(rec->linkmap, sizeof(rec->linkmap), 0);
+    if (linkmap_size)
+        __aeabi_memcpy4(rec->linkmap, fp->cltbl, linkmap_size * sizeof(DWORD));
+    rec->crc = record_crc(rec);
+    rec->magic = WARMBOOT_MAGIC;
+}
+
+#endif
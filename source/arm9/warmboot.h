@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __WARMBOOT_H__
+#define __WARMBOOT_H__
+
+#include <stddef.h>
+#include "common.h"
+#include "ff.h"
+
+/* === Warm boot record ===
+ *
+ * When a program exits through miniboot's bootstub, miniboot starts over.
+ * To skip mounting the filesystem, looking up BOOT.NDS and walking its
+ * cluster chain again, the state of the opened BOOT.NDS is kept in a
+ * record after the bootstub's copy of miniboot. It is only trusted if its
+ * checksum matches, and if the volume boot record and the directory sector
+ * holding BOOT.NDS are unchanged - that is, if the card was not replaced
+ * and BOOT.NDS not rewritten in the meantime.
+ */
+
+#define WARMBOOT_MAGIC        0x424D574D // "MWMB" in ASCII
+#define WARMBOOT_LINKMAP_SIZE 64         // in words; room for 31 fragments
+
+typedef struct {
+    uint32_t magic;
+    uint16_t crc;      // CRC-16 of the rest of the record
+    uint16_t vbr_crc;  // CRC-16 of the volume boot record
+    uint16_t dir_crc;  // CRC-16 of the directory sector holding BOOT.NDS
+    LBA_t dir_sect;    // The directory sector holding BOOT.NDS
+    uint32_t mtime;    // BOOT.NDS's last write, as a FAT date (high) and time (low)
+    uint32_t fs[(offsetof(FATFS, win) + 3) / 4]; // FatFs volume state, without the window
+    FIL fp;            // BOOT.NDS, as opened
+    DWORD linkmap[WARMBOOT_LINKMAP_SIZE];
+} warmboot_t;
+
+/**
+ * @brief Find the warm boot record, if miniboot's bootstub is installed.
+ *
+ * The record has to be checked for WARMBOOT_MAGIC before it is used.
+ */
+warmboot_t *warmboot_record(void);
+
+/**
+ * @brief Initialize the storage device, and restore the filesystem and
+ * BOOT.NDS from the warm boot record, if it is valid.
+ *
+ * @return true if fs is mounted and fp is BOOT.NDS, opened for loading.
+ */
+bool warmboot_restore(FATFS *fs, FIL *fp);
+
+/**
+ * @brief Write the warm boot record for an opened BOOT.NDS.
+ *
+ * @param dir_sect The directory sector holding BOOT.NDS; this is the FatFs
+ * window sector right after f_open().
+ */
+void warmboot_save(const FATFS *fs, const FIL *fp, LBA_t dir_sect);
+
+#endif /* __WARMBOOT_H__ */
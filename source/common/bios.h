@@ -14,6 +14,15 @@ static inline void swiSoftReset(void) {
     __builtin_unreachable();
 }
 
+__attribute__((always_inline))
+static inline uint16_t swiCRC16(uint16_t crc, const void *data, uint32_t size) {
+    register uint32_t r0 asm("r0") = crc;
+    register const void* r1 asm("r1") = data;
+    register uint32_t r2 asm("r2") = size;
+    asm volatile inline ("swi 0x0E << ((1f - . == 4) * -16); 1:" : "+r"(r0), "+r"(r1), "+r"(r2) :: "r3", "memory");
+    return r0;
+}
+
 __attribute__((always_inline))
 static inline void swiBitUnpack(const uint8_t *source, uint32_t *destination, const void *params) {
     register const uint8_t* r0 asm("r0") = source;
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __BOOT_METRICS_H__
+#define __BOOT_METRICS_H__
+
+#include <stdint.h>
+
+/* === miniboot boot metrics record ===
+ *
+ * Written by miniboot right before launching BOOT.NDS, so that the
+ * launched program can inspect how long booting took. It is placed below
+ * the .nds header and argv areas, which are left untouched. Programs
+ * reading it should check both the magic and the version.
+ */
+
+#define BOOT_METRICS_MAGIC   0x544D424D // "MBMT" in ASCII
+#define BOOT_METRICS_VERSION 1
+
+/**
+ * Number of entries in phase_us, in this order: ARM7 sync, bootstub
+ * creation, DLDI driver backup, FAT mount, BOOT.NDS open, header read,
+ * ARM7 load, ARM7 copy wait, ARM9 load, DLDI patch, handoff.
+ */
+#define BOOT_METRICS_PHASES  11
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;                            // sizeof(boot_metrics_t)
+    uint32_t phase_us[BOOT_METRICS_PHASES];   // Time spent in each phase, in microseconds
+    uint32_t sectors_read;                    // Sectors read through the DLDI driver
+    uint32_t dldi_commands;                   // DLDI readSectors() calls
+    uint32_t arm7_bytes_copied;               // Bytes relocated by the ARM7
+    char dldi_name[48];                       // DLDI driver friendly name
+} boot_metrics_t;
+
+#define BOOT_METRICS ((boot_metrics_t*) 0x2FFFD00)
+
+#endif /* __BOOT_METRICS_H__ */
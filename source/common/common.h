@@ -42,6 +42,8 @@ uint32_t xor_constant(uint32_t a, uint32_t b); // a ^ b, implemented in ASM to p
 
 #define IPCSYNC_INPUT(n)       (n)
 #define IPCSYNC_OUTPUT(n)      ((n) << 8)
+#define IPCSYNC_IRQ_REQUEST    (1<<13)
+#define IPCSYNC_IRQ_ENABLE     (1<<14)
 
 #define REG_IPCSYNC            (*((volatile uint32_t*) 0x4000180))
 #define REG_IPCFIFOCNT         (*((volatile uint32_t*) 0x4000184))
@@ -49,6 +51,21 @@ uint32_t xor_constant(uint32_t a, uint32_t b); // a ^ b, implemented in ASM to p
 #define REG_IPCFIFORECV        (*((volatile uint32_t*) 0x4100000))
 #define REG_POWCNT             (*((volatile uint16_t*) 0x4000304))
 
+#define IRQ_IPC_SYNC           (1<<16)
+#define REG_IME                (*((volatile uint32_t*) 0x4000208))
+#define REG_IE                 (*((volatile uint32_t*) 0x4000210))
+#define REG_IF                 (*((volatile uint32_t*) 0x4000214))
+
+#define TIMER_DIV_1            0
+#define TIMER_DIV_64           1
+#define TIMER_DIV_256          2
+#define TIMER_DIV_1024         3
+#define TIMER_CASCADE          (1<<2)
+#define TIMER_ENABLE           (1<<7)
+#define REG_TMCNT(n)           (*((volatile uint32_t*) (0x4000100 + ((n) << 2))))
+#define REG_TMCNT_L(n)         (*((volatile uint16_t*) (0x4000100 + ((n) << 2))))
+#define REG_TMCNT_H(n)         (*((volatile uint16_t*) (0x4000102 + ((n) << 2))))
+
 #if defined(ARM9)
 #define MEM_PALETTE_BG         ((uint16_t*) 0x5000000)
 #define DISPCNT_BG_MODE(n)     (n)
@@ -69,6 +86,7 @@ uint32_t xor_constant(uint32_t a, uint32_t b); // a ^ b, implemented in ASM to p
 #define REG_VRAMCNT_EFGW       (*((volatile uint32_t*) 0x4000244))
 
 #define VRAMCNT_HI(h,i)        ((h) | ((i)<<8))
+#define REG_WRAMCNT            (*((volatile uint8_t*) 0x4000247))
 #define REG_VRAMCNT_HI         (*((volatile uint16_t*) 0x4000248))
 
 #define KEY_A                  0x001
@@ -0,0 +1,38 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+#ifndef __NDSPACK_H__
+#define __NDSPACK_H__
+
+#include <stdint.h>
+
+/* === miniboot packed .nds extension ===
+ *
+ * tools/ndspack can replace the ARM9 and ARM7 binaries of a .nds file with
+ * BIOS-compatible LZ77 streams (type 0x10), which miniboot unpacks while
+ * loading. The binaries stay at their offsets in the file, so nothing else
+ * has to move; the header keeps their unpacked sizes, and this extension,
+ * in the otherwise zero-filled header bytes right after nds_header_t,
+ * records which binaries are packed, and how many bytes they take up.
+ */
+
+#define NDSPACK_MAGIC  0x4B43504D // "MPCK" in ASCII
+#define NDSPACK_OFFSET 0x170      // Offset in the .nds header
+
+#define NDSPACK_ARM9   (1 << 0)
+#define NDSPACK_ARM7   (1 << 1)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t arm9_packed_size; // Size of the packed stream, including its 4-byte header
+    uint32_t arm7_packed_size;
+} ndspack_header_t;
+
+/**
+ * The 4-byte header of an LZ77 stream of the given unpacked size.
+ */
+#define NDSPACK_LZ77_HEADER(size) (((size) << 8) | 0x10)
+
+#endif /* __NDSPACK_H__ */
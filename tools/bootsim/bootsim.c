@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+/* Host-side boot simulator.
+ *
+ * Runs the miniboot loader (loader.c, dldi_patch.c, diskio.c, linkmap.c and
+ * FatFs) against a FAT disk image, with the parts of the NDS memory map it
+ * touches simulated by fixed host mappings, then reports the boot I/O and
+ * checks the loaded binaries against the file. */
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "console.h"
+#include "diskio_stats.h"
+#include "ipc.h"
+#include "loader.h"
+#include "timing.h"
+
+#define DLDI_BACKUP   ((DLDI_INTERFACE*) 0x6820000)
+#define DLDI_BACKUP_SIZE 16384
+
+/* === Simulated memory map === */
+
+static const struct {
+    uint32_t start;
+    uint32_t size;
+    const char *name;
+} sim_regions[] = {
+    // Main RAM, including the 0x27FFE00 header and 0x2FFxxxx areas.
+    {0x2000000, 0x1000000, "main RAM"},
+    // Shared WRAM and ARM7 WRAM.
+    {0x3000000, 0x0810000, "WRAM"},
+    // VRAM banks A-D in LCDC mode: DLDI backup, link map, sector cache.
+    {0x6800000, 0x00A4000, "LCDC VRAM"}
+};
+
+static void sim_map_memory(void) {
+    for (size_t i = 0; i < sizeof(sim_regions) / sizeof(sim_regions[0]); i++) {
+        void *addr = (void*) (uintptr_t) sim_regions[i].start;
+        void *p = mmap(addr, sim_regions[i].size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != addr) {
+            fprintf(stderr, "bootsim: could not map %s at %08X\n", sim_regions[i].name, sim_regions[i].start);
+            exit(1);
+        }
+    }
+}
+
+/* === Simulated shared WRAM ===
+ *
+ * Shared WRAM is kept in sim_wram, and copied in and out of the flat WRAM
+ * mapping whenever the ARM9's view of it changes: all 32 KB at 0x37F8000,
+ * where binaries are read in place, or one 16 KB half at 0x3000000, for
+ * staging. The ARM7's half is only ever read by its copy jobs.
+ */
+
+static uint8_t sim_wram[0x8000];
+static uint8_t sim_wram_mapping = WRAM_ARM7;
+
+static void sim_wram_transfer(bool to_flat) {
+    uint8_t *flat = (uint8_t*) 0x37F8000;
+    uint8_t *bank = sim_wram;
+    uint32_t size = sizeof(sim_wram);
+
+    if (sim_wram_mapping == WRAM_ARM9_HIGH || sim_wram_mapping == WRAM_ARM9_LOW) {
+        flat = (uint8_t*) 0x3000000;
+        bank += sim_wram_mapping == WRAM_ARM9_HIGH ? 0x4000 : 0;
+        size = 0x4000;
+    }
+    if (to_flat)
+        memcpy(flat, bank, size);
+    else
+        memcpy(bank, flat, size);
+}
+
+// Translate an address as seen by the ARM7.
+static void *sim_arm7_address(uint32_t address) {
+    if ((sim_wram_mapping == WRAM_ARM9_HIGH || sim_wram_mapping == WRAM_ARM9_LOW)
+        && IN_RANGE_EX(address, 0x3000000, 0x3004000))
+        return sim_wram + (sim_wram_mapping == WRAM_ARM9_HIGH ? 0 : 0x4000) + (address - 0x3000000);
+    return (void*) (uintptr_t) address;
+}
+
+/* === File-backed DLDI stand-in === */
+
+static int image_fd = -1;
+
+static bool sim_startup(void) { return image_fd >= 0; }
+static bool sim_is_inserted(void) { return true; }
+static bool sim_clear_status(void) { return true; }
+static bool sim_shutdown(void) { return true; }
+
+static bool sim_read_sectors(uint32_t sector, uint32_t count, void *buffer) {
+    size_t size = (size_t) count * 512;
+    return pread(image_fd, buffer, size, (off_t) sector * 512) == (ssize_t) size;
+}
+
+DLDI_INTERFACE _io_dldi_stub = {
+    .magicNumber = 0xBF8DA5ED,
+    .magicString = " Chishm",
+    .versionNumber = 1,
+    .driverSize = DLDI_SIZE_1KB,
+    .allocatedSize = DLDI_SIZE_16KB,
+    .friendlyName = "bootsim disk image",
+    .ioType = 0x4D495342, // "BSIM"
+    .features = FEATURE_MEDIUM_CANREAD,
+    .startup = sim_startup,
+    .isInserted = sim_is_inserted,
+    .readSectors = sim_read_sectors,
+    .clearStatus = sim_clear_status,
+    .shutdown = sim_shutdown
+};
+
+/* === Simulated ARM7 === */
+
+uint32_t arm7_bytes_copied = 0;
+static uint32_t arm7_copies = 0;
+static uint32_t job_head = 0, job_submitted = 0;
+
+void ipc_arm7_cmd(uint32_t cmd) {
+}
+
+void ipc_arm7_queue(uint32_t op, uint32_t dest, uint32_t src, uint32_t size) {
+    ipc_job_ring_t *ring = IPC_JOB_RING;
+    if (!job_head) {
+        ring->done = 0;
+        ring->copy_ticks = 0;
+    }
+    if (job_head - ring->done >= IPC_JOB_COUNT) {
+        ipc_arm7_submit();
+        ipc_arm7_wait(PHASE_ARM7_WAIT);
+    }
+    ring->jobs[job_head % IPC_JOB_COUNT] = (ipc_job_t) {op, src, dest, size};
+    if (op == IPC_JOB_COPY) {
+        arm7_bytes_copied += size;
+        arm7_copies++;
+    }
+    job_head++;
+}
+
+void ipc_arm7_submit(void) {
+    // Like the ARM7, finish the previous batch before taking the next one.
+    ipc_arm7_wait(PHASE_ARM7_WAIT);
+    job_submitted = job_head;
+}
+
+void ipc_wram_map(uint8_t mapping) {
+    if (IPC_JOB_RING->done != job_submitted) {
+        fprintf(stderr, "bootsim: shared WRAM remapped while ARM7 jobs are in flight\n");
+        exit(1);
+    }
+    sim_wram_transfer(false);
+    sim_wram_mapping = mapping;
+    sim_wram_transfer(true);
+}
+
+void ipc_arm7_wait(boot_phase_t phase) {
+    // Run the jobs as late as the protocol allows, so that the ARM9
+    // overwriting a staging chunk before waiting for it shows up as a
+    // mismatch.
+    ipc_job_ring_t *ring = IPC_JOB_RING;
+    for (; ring->done != job_submitted; ring->done++) {
+        ipc_job_t *job = &ring->jobs[ring->done % IPC_JOB_COUNT];
+        uint32_t *dest = sim_arm7_address(job->dest);
+        if (job->op == IPC_JOB_COPY) {
+            memmove(dest, sim_arm7_address(job->src), job->size);
+        } else {
+            for (uint32_t i = 0; i < (job->size >> 2); i++)
+                dest[i] = job->op == IPC_JOB_FILL ? job->src : 0;
+        }
+    }
+}
+
+static uint32_t *arm7_scan_result;
+
+void ipc_arm7_scan(const uint32_t *data, uint32_t size, const uint32_t *key) {
+    if (IPC_JOB_RING->done != job_submitted) {
+        fprintf(stderr, "bootsim: ARM7 scan issued while jobs are in flight\n");
+        exit(1);
+    }
+    arm7_scan_result = NULL;
+    for (; size; size -= 4, data++) {
+        if (data[0] == key[0] && data[1] == key[1] && data[2] == key[2]) {
+            arm7_scan_result = (uint32_t*) data;
+            break;
+        }
+    }
+}
+
+uint32_t *ipc_arm7_scan_result(boot_phase_t phase) {
+    return arm7_scan_result;
+}
+
+/* === Platform functions === */
+
+bool debugEnabled = false;
+
+int eprintf(const char *format, ...) {
+    va_list val;
+    va_start(val, format);
+    int rv = vfprintf(stderr, format, val);
+    va_end(val);
+    return rv;
+}
+
+void checkErrorFatFs(const char *msg, int result) {
+    if (result == FR_OK) return;
+    eprintf("%s: FatFs error %d\n", msg, result);
+    haltOnError();
+}
+
+void haltOnError(void) {
+    eprintf("\n");
+    exit(1);
+}
+
+// Host timings say nothing about the hardware; only the I/O is reported.
+void timing_phase(boot_phase_t phase) {
+}
+
+uint32_t xor_constant(uint32_t a, uint32_t b) {
+    return a ^ b;
+}
+
+// Host version of dldi_scan.s.
+uint32_t *dldi_scan(const uint32_t *data, uint32_t size, uint32_t key) {
+    for (; size; size -= 4, data++) {
+        if (*data == key) return (uint32_t*) data;
+    }
+    return NULL;
+}
+
+// The host has no cache to maintain.
+void dc_flush_range(const void *base, uint32_t size) {
+}
+
+void dc_flush_all(void) {
+}
+
+void __aeabi_memcpy(void *dest, const void *src, size_t n) { memmove(dest, src, n); }
+void __aeabi_memcpy4(void *dest, const void *src, size_t n) { memmove(dest, src, n); }
+void __aeabi_memset(void *dest, size_t n, int c) { memset(dest, c, n); }
+
+/* === Verification === */
+
+/**
+ * @brief Find the DLDI stub in a binary, like dldi_patch_relocate().
+ */
+static const uint8_t *find_dldi_stub(const uint8_t *data, uint32_t size) {
+    for (uint32_t i = 0; i + 16 <= size; i += 4) {
+        if (!memcmp(data + i, "\xED\xA5\x8D\xBF Chishm", 12))
+            return data + i;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Compare a loaded binary against BOOT.NDS, skipping the DLDI stub.
+ *
+ * @return bool true if the binary matches.
+ */
+static bool verify_binary(FIL *fp, const char *name, uint32_t offset, uint32_t address, uint32_t size, bool patched) {
+    uint8_t *expected = malloc(size);
+    const uint8_t *actual = (const uint8_t*) (uintptr_t) address;
+    unsigned int bytes_read;
+    uint32_t skip_start = size, skip_end = size;
+    uint32_t mismatches = 0, first_mismatch = 0;
+    bool match = true;
+
+    if (!expected || f_lseek(fp, offset) != FR_OK
+        || f_read(fp, expected, size, &bytes_read) != FR_OK || bytes_read != size) {
+        printf("%s: could not read for verification\n", name);
+        free(expected);
+        return false;
+    }
+
+    const uint8_t *stub = patched ? find_dldi_stub(expected, size) : NULL;
+    if (stub) {
+        skip_start = stub - expected;
+        skip_end = MIN(size, skip_start + (1 << stub[15]));
+        // Patching copies the driver's friendly name along with its code.
+        match = !memcmp(actual + skip_start + 16, DLDI_BACKUP->friendlyName, DLDI_FRIENDLY_NAME_LEN);
+        printf("DLDI patch: stub at +0x%X, %u bytes allocated, %s\n", skip_start, 1 << stub[15],
+            match ? "patched" : "NOT patched");
+    } else if (patched) {
+        printf("DLDI patch: no stub found\n");
+    }
+
+    for (uint32_t i = 0; i < size; i++) {
+        if (i == skip_start) i = skip_end;
+        if (i < size && actual[i] != expected[i] && !mismatches++)
+            first_mismatch = i;
+    }
+
+    if (mismatches)
+        printf("%s: %u bytes differ, first at +0x%X\n", name, mismatches, first_mismatch);
+    else
+        printf("%s: OK\n", name);
+    free(expected);
+    return match && !mismatches;
+}
+
+/* === Main logic === */
+
+static void usage(void) {
+    fprintf(stderr, "usage: bootsim [-v] [-d driver.dldi] [-p path] [-r path] image\n"
+        "  -v  print the loader's debug output\n"
+        "  -d  DLDI driver to patch in (default: the stand-in driver)\n"
+        "  -p  file to boot (default: /BOOT.NDS)\n"
+        "  -r  unpacked file to verify against (default: the file booted)\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *driver_path = NULL;
+    const char *executable_path = "/BOOT.NDS";
+    const char *reference_path = NULL;
+    static FATFS fs;
+    FIL fp;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vd:p:r:")) != -1) {
+        switch (opt) {
+            case 'v': debugEnabled = true; break;
+            case 'd': driver_path = optarg; break;
+            case 'p': executable_path = optarg; break;
+            case 'r': reference_path = optarg; break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1) usage();
+
+    if ((image_fd = open(argv[optind], O_RDONLY)) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    sim_map_memory();
+
+    // Set up the driver copy used for patching, as main.c does.
+    if (driver_path) {
+        FILE *f = fopen(driver_path, "rb");
+        long size = -1;
+        if (f && !fseek(f, 0, SEEK_END) && (size = ftell(f)) > 0 && size <= DLDI_BACKUP_SIZE) {
+            rewind(f);
+            if (fread(DLDI_BACKUP, 1, size, f) != (size_t) size) size = -1;
+        }
+        if (size <= 0 || size > DLDI_BACKUP_SIZE) {
+            fprintf(stderr, "bootsim: could not read %s (at most %d bytes)\n", driver_path, DLDI_BACKUP_SIZE);
+            return 1;
+        }
+        fclose(f);
+    } else {
+        __aeabi_memcpy(DLDI_BACKUP, &_io_dldi_stub, sizeof(_io_dldi_stub));
+    }
+
+    checkErrorFatFs("Could not mount FAT filesystem", f_mount(&fs, "", 1));
+    checkErrorFatFs("Could not find BOOT.NDS", f_open(&fp, executable_path, FA_READ));
+    loader_open(&fp);
+    loader_read_header(&fp);
+    loader_load_binaries(&fp, DLDI_BACKUP);
+    ipc_arm7_wait(PHASE_HANDOFF);
+    ipc_wram_map(WRAM_ARM7);
+
+    // Snapshot the statistics before verification reads the file again.
+    disk_stats_t stats = disk_stats;
+
+    printf("%s: ARM9 %u bytes @ 0x%X, ARM7 %u bytes @ 0x%X\n", executable_path,
+        NDS_HEADER->arm9_size, NDS_HEADER->arm9_start, NDS_HEADER->arm7_size, NDS_HEADER->arm7_start);
+#if FF_USE_FASTSEEK
+    if (fp.cltbl)
+        printf("Link map: %u fragments\n", (fp.cltbl[0] - 1) >> 1);
+    else
+        printf("Link map: none\n");
+#endif
+    printf("Disk: %u sectors read in %u DLDI commands\n", stats.sectors, stats.commands);
+#if FF_WF_MARK_WINDOW_READS
+    printf("Sector cache: %u hits, %u misses\n", stats.cache_hits, stats.cache_misses);
+#endif
+    printf("ARM7: %u bytes copied in %u chunks\n", arm7_bytes_copied, arm7_copies);
+
+    // Packed binaries are verified against an unpacked copy of the file.
+    if (reference_path) {
+        f_close(&fp);
+        checkErrorFatFs("Could not find reference file", f_open(&fp, reference_path, FA_READ));
+    }
+    bool ok = verify_binary(&fp, "ARM9", NDS_HEADER->arm9_offset, NDS_HEADER->arm9_start, NDS_HEADER->arm9_size, true);
+    ok &= verify_binary(&fp, "ARM7", NDS_HEADER->arm7_offset, NDS_HEADER->arm7_start, NDS_HEADER->arm7_size, false);
+    return ok ? 0 : 1;
+}
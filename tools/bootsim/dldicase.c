@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+/* Writes a bootsim test case for DLDI patching of packed ARM9 binaries.
+ *
+ * The stub is found in the packed ARM9 binary's first chunk, and its area
+ * ends just before the second chunk does, so that it is patched right then.
+ * The rest is back-references, starting with some into that area, which
+ * must unpack to the original stub bytes, not the patched ones. Put both
+ * files on a disk image, and run bootsim -p /CASE.NDS -r /REF.NDS on it. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ndspack.h"
+
+#define CHUNK_SIZE   0x8000 // PACKED_CHUNK_SIZE in source/arm9/loader.c
+#define ARM9_START   0x2000000
+#define ARM9_SIZE    0x20000
+#define ARM7_START   0x2380000
+#define ARM7_SIZE    0x400
+#define STUB_ALLOC   15     // 32 KB
+#define STUB_GAP     64     // Bytes between the stub area and the second chunk's end
+#define COPY_DIST    100    // Back-reference distance
+
+static uint32_t seed = 1;
+
+static uint8_t next_byte(void) {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+static void write32(uint8_t *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static void write_file(const char *path, const uint8_t *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(data, 1, size, f) != size || fclose(f)) {
+        fprintf(stderr, "dldicase: could not write %s\n", path);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: dldicase case.nds ref.nds\n");
+        return 1;
+    }
+
+    // Without back-references, every 8 bytes take 9 in the stream, after
+    // its 4-byte header: find where the second chunk ends in the output.
+    uint32_t literals = 2 * CHUNK_SIZE - 4;
+    uint32_t chunk_end = literals / 9 * 8 + (literals % 9 ? literals % 9 - 1 : 0);
+    uint32_t stub = (chunk_end - STUB_GAP - (1 << STUB_ALLOC)) & ~3;
+
+    uint8_t arm9[ARM9_SIZE];
+    for (uint32_t i = 0; i < ARM9_SIZE; i++)
+        arm9[i] = next_byte();
+    memcpy(arm9 + stub, "\xED\xA5\x8D\xBF Chishm", 12);
+    arm9[stub + 15] = STUB_ALLOC;
+    for (uint32_t i = chunk_end; i < ARM9_SIZE; i++)
+        arm9[i] = arm9[i - COPY_DIST];
+
+    // Pack: literals up to the chunk end, and back-references after it.
+    uint8_t packed[4 + ARM9_SIZE + ARM9_SIZE / 8];
+    uint32_t out = 4, flags = 0, token = 8;
+    write32(packed, NDSPACK_LZ77_HEADER(ARM9_SIZE));
+    for (uint32_t pos = 0; pos < ARM9_SIZE; token++) {
+        if (token == 8) {
+            flags = out;
+            packed[out++] = 0;
+            token = 0;
+        }
+        uint32_t length = ARM9_SIZE - pos < 18 ? ARM9_SIZE - pos : 18;
+        if (pos >= chunk_end && length >= 3) {
+            packed[flags] |= 0x80 >> token;
+            packed[out++] = ((length - 3) << 4) | ((COPY_DIST - 1) >> 8);
+            packed[out++] = (COPY_DIST - 1) & 0xFF;
+            pos += length;
+        } else {
+            packed[out++] = arm9[pos++];
+        }
+    }
+
+    uint8_t arm7[ARM7_SIZE];
+    for (uint32_t i = 0; i < ARM7_SIZE; i++)
+        arm7[i] = next_byte();
+
+    size_t size = 0x200 + ARM9_SIZE + ARM7_SIZE;
+    uint8_t *file = calloc(size, 1);
+    if (!file) {
+        fprintf(stderr, "dldicase: out of memory\n");
+        return 1;
+    }
+    write32(file + 0x20, 0x200);
+    write32(file + 0x24, ARM9_START);
+    write32(file + 0x28, ARM9_START);
+    write32(file + 0x2C, ARM9_SIZE);
+    write32(file + 0x30, 0x200 + ARM9_SIZE);
+    write32(file + 0x34, ARM7_START);
+    write32(file + 0x38, ARM7_START);
+    write32(file + 0x3C, ARM7_SIZE);
+    memcpy(file + 0x200 + ARM9_SIZE, arm7, ARM7_SIZE);
+
+    memcpy(file + 0x200, arm9, ARM9_SIZE);
+    write_file(argv[2], file, size);
+
+    memset(file + 0x200, 0, ARM9_SIZE);
+    memcpy(file + 0x200, packed, out);
+    write32(file + NDSPACK_OFFSET + offsetof(ndspack_header_t, magic), NDSPACK_MAGIC);
+    write32(file + NDSPACK_OFFSET + offsetof(ndspack_header_t, flags), NDSPACK_ARM9);
+    write32(file + NDSPACK_OFFSET + offsetof(ndspack_header_t, arm9_packed_size), out);
+    write_file(argv[1], file, size);
+
+    printf("stub at +0x%X, second chunk ends at +0x%X\n", stub, chunk_end);
+    free(file);
+    return 0;
+}
@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: Zlib
+//
+// Copyright (c) 2024 Adrian "asie" Siekierka
+
+/* Packs the ARM9 and/or ARM7 binaries of a .nds file for miniboot.
+ *
+ * Each binary is replaced, at its offset in the file, by a BIOS-compatible
+ * LZ77 stream, and the rest of its space is zero-filled; the packing
+ * extension is then written to the header. See source/common/ndspack.h.
+ * Binaries which do not get smaller are left as they are.
+ *
+ * With -s, packs miniboot's own ARM9 binary instead, built with PACK=1;
+ * see source/arm9/crt0.s. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ndspack.h"
+
+#define MIN_MATCH    3
+#define MAX_MATCH    18
+#define MAX_DISTANCE 4096
+#define HASH_SIZE    (1 << 16)
+
+#define SELF_MAGIC   0x394B504D // "MPK9" in ASCII
+#define SELF_HEADER  0x20       // Offset of the image layout in arm9.bin
+
+static uint32_t read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void write32(uint8_t *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t hash3(const uint8_t *p) {
+    return ((p[0] << 8) ^ (p[1] << 4) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+/**
+ * Compress data with greedy matching over hash chains. Returns the packed
+ * size, including the stream header; out must hold at least
+ * 4 + size + (size + 7) / 8 bytes.
+ */
+static size_t lz77_pack(uint8_t *out, const uint8_t *data, size_t size) {
+    int32_t *head = malloc(HASH_SIZE * sizeof(int32_t));
+    int32_t *prev = malloc((size ? size : 1) * sizeof(int32_t));
+    if (!head || !prev) {
+        fprintf(stderr, "ndspack: out of memory\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < HASH_SIZE; i++)
+        head[i] = -1;
+
+    write32(out, NDSPACK_LZ77_HEADER((uint32_t) size));
+    size_t out_pos = 4;
+    size_t flags_pos = 0;
+    int token = 8;
+
+    size_t pos = 0;
+    while (pos < size) {
+        if (token == 8) {
+            flags_pos = out_pos;
+            out[out_pos++] = 0;
+            token = 0;
+        }
+
+        // Find the longest match in the window.
+        size_t best_length = 0, best_distance = 0;
+        size_t max_length = size - pos < MAX_MATCH ? size - pos : MAX_MATCH;
+        if (max_length >= MIN_MATCH) {
+            for (int32_t match = head[hash3(data + pos)]; match >= 0 && pos - match <= MAX_DISTANCE; match = prev[match]) {
+                size_t length = 0;
+                while (length < max_length && data[match + length] == data[pos + length])
+                    length++;
+                if (length > best_length) {
+                    best_length = length;
+                    best_distance = pos - match;
+                    if (length == max_length) break;
+                }
+            }
+        }
+
+        size_t advance;
+        if (best_length >= MIN_MATCH) {
+            out[flags_pos] |= 0x80 >> token;
+            out[out_pos++] = ((best_length - MIN_MATCH) << 4) | ((best_distance - 1) >> 8);
+            out[out_pos++] = (best_distance - 1) & 0xFF;
+            advance = best_length;
+        } else {
+            out[out_pos++] = data[pos];
+            advance = 1;
+        }
+        token++;
+
+        for (; advance; advance--, pos++) {
+            if (pos + MIN_MATCH <= size) {
+                uint32_t h = hash3(data + pos);
+                prev[pos] = head[h];
+                head[h] = pos;
+            }
+        }
+    }
+
+    free(prev);
+    free(head);
+    return out_pos;
+}
+
+static bool pack_binary(uint8_t *file, size_t file_size, const char *name,
+                        uint32_t offset, uint32_t size, uint32_t *packed_size) {
+    if (offset > file_size || size > file_size - offset) {
+        fprintf(stderr, "ndspack: %s binary lies outside the file\n", name);
+        exit(1);
+    }
+    if (size >= (1 << 24)) {
+        fprintf(stderr, "ndspack: %s binary too large to pack\n", name);
+        exit(1);
+    }
+
+    uint8_t *out = malloc(4 + size + (size + 7) / 8);
+    if (!out) {
+        fprintf(stderr, "ndspack: out of memory\n");
+        exit(1);
+    }
+    size_t out_size = lz77_pack(out, file + offset, size);
+
+    bool smaller = out_size < size;
+    if (smaller) {
+        memcpy(file + offset, out, out_size);
+        memset(file + offset + out_size, 0, size - out_size);
+        *packed_size = out_size;
+        printf("%s: %u -> %u bytes (%.1f%%)\n", name, size, (unsigned) out_size, out_size * 100.0 / size);
+    } else {
+        printf("%s: %u bytes, left unpacked\n", name, size);
+    }
+    free(out);
+    return smaller;
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *data = malloc(*size ? *size : 1);
+    if (!data || fread(data, 1, *size, f) != *size) {
+        fprintf(stderr, "ndspack: could not read %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+    return data;
+}
+
+static void write_file(const char *path, const uint8_t *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    if (!f || fwrite(data, 1, size, f) != size || fclose(f)) {
+        fprintf(stderr, "ndspack: could not write %s\n", path);
+        exit(1);
+    }
+}
+
+/**
+ * Pack miniboot's ARM9 binary: the code before the packed area stays as is,
+ * followed by the DLDI area, so that it can still be DLDI patched, and then
+ * by the rest of the code as an LZ77 stream.
+ */
+static int pack_self(const char *in_path, const char *out_path) {
+    size_t size;
+    uint8_t *file = read_file(in_path, &size);
+
+    if (size < SELF_HEADER + 16 || read32(file + SELF_HEADER) != SELF_MAGIC) {
+        fprintf(stderr, "ndspack: %s is not a miniboot ARM9 binary built with PACK=1\n", in_path);
+        return 1;
+    }
+    uint32_t head_size = read32(file + SELF_HEADER + 4);
+    uint32_t dldi_offset = read32(file + SELF_HEADER + 8);
+    uint32_t image_size = read32(file + SELF_HEADER + 12);
+    if (image_size != size || head_size > dldi_offset || dldi_offset > image_size || (head_size & 3)) {
+        fprintf(stderr, "ndspack: %s has an unexpected layout\n", in_path);
+        return 1;
+    }
+
+    uint32_t code_size = dldi_offset - head_size;
+    uint32_t dldi_size = image_size - dldi_offset;
+    uint8_t *out = malloc(head_size + dldi_size + 4 + code_size + (code_size + 7) / 8 + 3);
+    if (!out) {
+        fprintf(stderr, "ndspack: out of memory\n");
+        return 1;
+    }
+    memcpy(out, file, head_size);
+    memcpy(out + head_size, file + dldi_offset, dldi_size);
+    size_t out_size = head_size + dldi_size;
+    out_size += lz77_pack(out + out_size, file + head_size, code_size);
+    while (out_size & 3)
+        out[out_size++] = 0;
+
+    printf("arm9: %u -> %u bytes (%.1f%%)\n", (unsigned) size, (unsigned) out_size, out_size * 100.0 / size);
+    write_file(out_path, out, out_size);
+    free(out);
+    free(file);
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: ndspack [-9] [-7] in.nds out.nds\n"
+        "       ndspack -s arm9.bin out.bin\n"
+        "  -9  pack the ARM9 binary\n"
+        "  -7  pack the ARM7 binary\n"
+        "  (default: both)\n"
+        "  -s  pack miniboot's own ARM9 binary\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    bool pack_arm9 = false, pack_arm7 = false, pack_self_image = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "97s")) != -1) {
+        switch (opt) {
+            case '9': pack_arm9 = true; break;
+            case '7': pack_arm7 = true; break;
+            case 's': pack_self_image = true; break;
+            default: usage();
+        }
+    }
+    if (argc - optind != 2 || (pack_self_image && (pack_arm9 || pack_arm7)))
+        usage();
+    if (pack_self_image)
+        return pack_self(argv[optind], argv[optind + 1]);
+    if (!pack_arm9 && !pack_arm7)
+        pack_arm9 = pack_arm7 = true;
+
+    size_t file_size;
+    uint8_t *file = read_file(argv[optind], &file_size);
+
+    if (file_size < 0x200) {
+        fprintf(stderr, "ndspack: %s is not a .nds file\n", argv[optind]);
+        return 1;
+    }
+    for (int i = 0; i < (int) sizeof(ndspack_header_t); i++) {
+        if (file[NDSPACK_OFFSET + i]) {
+            fprintf(stderr, "ndspack: %s is already packed, or uses header bytes %X-%X\n",
+                argv[optind], NDSPACK_OFFSET, NDSPACK_OFFSET + (int) sizeof(ndspack_header_t) - 1);
+            return 1;
+        }
+    }
+
+    uint32_t flags = 0, arm9_packed_size = 0, arm7_packed_size = 0;
+    if (pack_arm9 && pack_binary(file, file_size, "ARM9", read32(file + 0x20), read32(file + 0x2C), &arm9_packed_size))
+        flags |= NDSPACK_ARM9;
+    if (pack_arm7 && pack_binary(file, file_size, "ARM7", read32(file + 0x30), read32(file + 0x3C), &arm7_packed_size))
+        flags |= NDSPACK_ARM7;
+
+    if (flags) {
+        uint8_t *ext = file + NDSPACK_OFFSET;
+        write32(ext + offsetof(ndspack_header_t, magic), NDSPACK_MAGIC);
+        write32(ext + offsetof(ndspack_header_t, flags), flags);
+        write32(ext + offsetof(ndspack_header_t, arm9_packed_size), arm9_packed_size);
+        write32(ext + offsetof(ndspack_header_t, arm7_packed_size), arm7_packed_size);
+    }
+
+    write_file(argv[optind + 1], file, file_size);
+    free(file);
+    return 0;
+}